@@ -0,0 +1,148 @@
+//
+// Copyright 2009 Autodesk, Inc.  All rights reserved.
+//
+// Use of this software is subject to the terms of the Autodesk license
+// agreement provided at the time of installation or download, or which
+// otherwise accompanies this software in either electronic or hard copy form.
+//
+
+#pragma once
+
+#include <assert1.h>
+#include "SmallArray.h"
+
+//=========================================================
+/// Stores the number of references in each RefArray registered
+/// with a ReferenceManager.
+///
+/// The sizes are kept in a Fenwick (binary indexed) tree, so both
+/// the offset of an array (the sum of the sizes of all the arrays
+/// below it) and changing the size of an array cost O(log arrays).
+/// Reading a single size is O(1).
+///
+/// Inserting arrays anywhere but the end rebuilds the tree, but
+/// that only happens when registering an array below an existing one.
+///
+/// Most classes have at most one array, so its size is stored
+/// inside the tree itself rather than on the heap.  Every manager
+/// has a tree, so no more is stored inline.
+class ArraySizeTree
+{
+private:
+	enum { kNumInlineArrays = 1 };
+
+	// The size of each array.
+	SmallArray<size_t, kNumInlineArrays> m_sizes;
+	// The Fenwick tree (1-based, m_tree[0] is unused).  Node i
+	// stores the sum of the sizes (i - LowBit(i), i]
+	SmallArray<size_t, kNumInlineArrays + 1> m_tree;
+
+	static size_t LowBit(size_t i) { return i & (~i + 1); }
+
+	// Rebuild m_tree from m_sizes in O(n)
+	void Rebuild()
+	{
+		m_tree.setLengthUsed(0);
+		m_tree.setLengthUsed(m_sizes.length() + 1, 0);
+		for (size_t i = 1; i < m_tree.length(); i++)
+		{
+			m_tree[i] += m_sizes[i - 1];
+			size_t parent = i + LowBit(i);
+			if (parent < m_tree.length())
+				m_tree[parent] += m_tree[i];
+		}
+	}
+
+public:
+
+	ArraySizeTree()
+	{
+		m_tree.setLengthUsed(1, 0);
+	}
+
+	/// Return the number of arrays
+	size_t size() const { return m_sizes.length(); }
+
+	/// Return the number of references in array i
+	size_t operator[](size_t i) const { return m_sizes[i]; }
+
+	/// Returns the total size of the arrays [0, i)
+	size_t PrefixSum(size_t i) const
+	{
+		DbgAssert(i <= m_sizes.length());
+		size_t total = 0;
+		for (; i > 0; i -= LowBit(i))
+			total += m_tree[i];
+		return total;
+	}
+
+	/// Find the array containing the reference offset references from the
+	/// start of array 0, ie the array i where PrefixSum(i) <= offset < PrefixSum(i + 1).
+	/// Empty arrays are skipped.  O(log arrays).
+	/// \param offset The offset to find.  This must be less than the total size.
+	/// \param offsetInArray Receives the offset of the reference in the array found.
+	/// \return The index of the array
+	size_t Find(size_t offset, size_t& offsetInArray) const
+	{
+		DbgAssert(offset < PrefixSum(m_sizes.length()));
+		size_t n = m_sizes.length();
+		size_t step = 1;
+		while (step * 2 <= n)
+			step *= 2;
+
+		// Descend the tree, skipping every node that ends at or before offset
+		size_t pos = 0;
+		for (; step > 0; step /= 2)
+		{
+			if (pos + step <= n && m_tree[pos + step] <= offset)
+			{
+				pos += step;
+				offset -= m_tree[pos];
+			}
+		}
+		offsetInArray = offset;
+		return pos;
+	}
+
+	/// Change the size of array i by delta
+	void Add(size_t i, ptrdiff_t delta)
+	{
+		DbgAssert(i < m_sizes.length());
+		m_sizes[i] += delta;
+		// Unsigned wrap-around gives the correct result for -ve deltas
+		for (size_t node = i + 1; node < m_tree.length(); node += LowBit(node))
+			m_tree[node] += delta;
+	}
+
+	/// Set the size of array i
+	void Set(size_t i, size_t value)
+	{
+		Add(i, ptrdiff_t(value - m_sizes[i]));
+	}
+
+	/// Add count new arrays of the given size to the end
+	void Append(size_t count, size_t value)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			m_sizes.append(value);
+			// The new node covers (n - LowBit(n), n], ie itself
+			// plus the tail of the arrays already present.
+			size_t n = m_sizes.length();
+			m_tree.append(value + PrefixSum(n - 1) - PrefixSum(n - LowBit(n)));
+		}
+	}
+
+	/// Insert count new arrays of the given size before array 'at'
+	void Insert(size_t at, size_t count, size_t value)
+	{
+		DbgAssert(at <= m_sizes.length());
+		if (at == m_sizes.length())
+		{
+			Append(count, value);
+			return;
+		}
+		m_sizes.insertAt(at, value, count);
+		Rebuild();
+	}
+};
@@ -0,0 +1,673 @@
+//
+// Host-side benchmarks for the ReferenceManager, RefPtr and RefArray.
+// These build against the SDK stand-in in SdkStandIn, see README.md
+//
+// Usage: RefMgrBenchmark [--quick] [name]
+//	--quick	Only run the smaller sizes, once each (used as a smoke test by ctest)
+//	name	Only run the benchmarks whose name contains this
+//
+
+#include "RefPtr.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Set by CMake for the C++17 build, when the standard library can run
+// the parallel algorithms.  See CMakeLists.txt
+#ifdef REFMGR_BENCH_PARALLEL_ALGORITHMS
+#include <execution>
+#endif
+
+namespace
+{
+	//------------------------------------------------------------------------
+	// The objects being measured
+
+	class BenchTarget : public ReferenceTarget
+	{
+	protected:
+		RefResult NotifyRefChanged(const Interval&, RefTargetHandle, PartID&, RefMessage, BOOL) { return REF_SUCCEED; }
+	};
+
+	enum BenchRefs
+	{
+		kSingleRef,
+		kArrayRef,
+	};
+
+	// A typical owner: one RefPtr, and a RefArray whose references share a callback
+	class BenchOwner : public ReferenceManager<ReferenceTarget>
+	{
+	public:
+		size_t m_numNotified;
+		RefPtr<BenchTarget, kSingleRef> m_single;
+		RefArray<BenchTarget, kArrayRef> m_array;
+
+		BenchOwner()
+			: m_numNotified(0)
+			, m_single(GetRefMgr())
+			, m_array(GetRefMgr(), MakeArrayNotifyCallback(this, &BenchOwner::OnArrayMsg))
+		{ }
+
+		RefResult OnArrayMsg(int index, RefMessage msg, PartID& partID)
+		{
+			UNUSED_PARAM(index); UNUSED_PARAM(msg); UNUSED_PARAM(partID);
+			m_numNotified++;
+			return REF_SUCCEED;
+		}
+
+		void CloneTo(BenchOwner& to, RemapDir& remap) { BaseClone(this, &to, remap); }
+	};
+
+	// A small owner of two RefPtrs and a RefArray, optionally declared by a layout
+	enum SmallRefs
+	{
+		kFirstRef,
+		kSecondRef,
+		kSmallArrayRef,
+	};
+	typedef RefLayout< RefIdList<kFirstRef, kSecondRef>, RefIdList<kSmallArrayRef> > SmallLayout;
+
+	template<typename LAYOUT_T>
+	class SmallOwner : public ReferenceManager<ReferenceTarget, 0, LAYOUT_T>
+	{
+	public:
+		RefPtr<BenchTarget, kFirstRef> m_first;
+		RefPtr<BenchTarget, kSecondRef> m_second;
+		RefArray<BenchTarget, kSmallArrayRef> m_array;
+
+		SmallOwner()
+			: m_first(this->GetRefMgr())
+			, m_second(this->GetRefMgr())
+			, m_array(this->GetRefMgr())
+		{ }
+	};
+
+	// Clones nothing, so clone measures only the managers own work
+	class PassThroughRemap : public RemapDir
+	{
+	public:
+		RefTargetHandle CloneRef(RefTargetHandle oldTarg) { return oldTarg; }
+	};
+
+	// A fixed set of targets, created outside the timed sections
+	class TargetSet
+	{
+		std::vector<BenchTarget*> m_targets;
+		TargetSet(const TargetSet&);
+		TargetSet& operator=(const TargetSet&);
+	public:
+		explicit TargetSet(size_t n) : m_targets(n) { for (size_t i = 0; i < n; i++) m_targets[i] = new BenchTarget; }
+		~TargetSet() { for (size_t i = m_targets.size(); i > 0; i--) delete m_targets[i - 1]; }
+		BenchTarget* operator[](size_t i) const { return m_targets[i]; }
+		size_t size() const { return m_targets.size(); }
+	};
+
+	//------------------------------------------------------------------------
+	// Timing
+
+	typedef std::chrono::steady_clock Clock;
+
+	double ElapsedNs(Clock::time_point start)
+	{
+		return double(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+	}
+
+	// Results that are wrong are worse than slow ones
+	void Check(bool condition, const char* benchmark, const char* what)
+	{
+		if (!condition)
+		{
+			fprintf(stderr, "FAILED: %s: %s\n", benchmark, what);
+			exit(1);
+		}
+	}
+
+	// Each benchmark sets up its own state, and returns the time (ns) and number
+	// of operations of its timed section only.
+	struct Sample
+	{
+		double ns;
+		double ops;
+	};
+	typedef Sample (*BenchmarkFn)(size_t n);
+
+	//------------------------------------------------------------------------
+	// The benchmarks.  n is the number of references involved.
+
+	// Append n references one at a time, then release them one at a time
+	Sample BenchRegisterRelease(size_t n)
+	{
+		BenchOwner owner;
+		Clock::time_point start = Clock::now();
+		for (size_t i = 0; i < n; i++)
+			owner.m_array.Append((BenchTarget*)NULL);
+		for (size_t i = n; i > 0; i--)
+			owner.m_array.Delete(int(i - 1), 1);
+		Sample s = { ElapsedNs(start), double(2 * n) };
+		Check(owner.NumRefs() == 1, "register_release", "references were not released");
+		return s;
+	}
+
+	// As register_release's append, with concurrent reads enabled.  The appends
+	// are made inside a DeferNotifyScope, so they are published once at the end
+	// rather than copying every reference after each append.
+	Sample BenchAppendConcurrent(size_t n)
+	{
+		TargetSet targets(n);
+		BenchOwner owner;
+		owner.EnableConcurrentReads(true);
+		Clock::time_point start = Clock::now();
+		{
+			BenchOwner::DeferNotifyScope defer(owner);
+			for (size_t i = 0; i < n; i++)
+				owner.m_array.Append(targets[i]);
+			Check(owner.NumRefsConcurrent() == 1, "append_concurrent", "appends were published before the deferral ended");
+		}
+		Sample s = { ElapsedNs(start), double(n) };
+		Check(owner.NumRefsConcurrent() == int(n) + 1, "append_concurrent", "appends were not published");
+		Check(owner.GetReferenceConcurrent(int(n)) == targets[n - 1], "append_concurrent", "wrong target published");
+		owner.EnableConcurrentReads(false);
+		owner.m_array.SetCount(0);
+		return s;
+	}
+
+	// Grow an array to n references in one call, then shrink it back to 0
+	Sample BenchArrayResize(size_t n)
+	{
+		BenchOwner owner;
+		Clock::time_point start = Clock::now();
+		owner.m_array.SetCount(int(n));
+		owner.m_array.SetCount(0);
+		Sample s = { ElapsedNs(start), double(n) };
+		Check(owner.NumRefs() == 1, "array_resize", "references were not released");
+		return s;
+	}
+
+	// Point each of n references at a target, then back to NULL
+	Sample BenchAssign(size_t n)
+	{
+		TargetSet targets(n);
+		BenchOwner owner;
+		owner.m_array.SetCount(int(n));
+		Clock::time_point start = Clock::now();
+		for (size_t i = 0; i < n; i++)
+			owner.m_array[int(i)] = targets[i];
+		for (size_t i = 0; i < n; i++)
+			owner.m_array[int(i)] = (BenchTarget*)NULL;
+		Sample s = { ElapsedNs(start), double(2 * n) };
+		Check(targets[0]->NumDependents() == 0, "assign", "references were not cleared");
+		return s;
+	}
+
+	// Read the target of each of n references through its RefPtr, several times over
+	Sample BenchDeref(size_t n)
+	{
+		const size_t kPasses = 16;
+		TargetSet targets(n);
+		BenchOwner owner;
+		owner.m_array.SetCount(int(n));
+		for (size_t i = 0; i < n; i++)
+			owner.m_array[int(i)] = targets[i];
+
+		size_t numMatched = 0;
+		Clock::time_point start = Clock::now();
+		for (size_t pass = 0; pass < kPasses; pass++)
+			for (size_t i = 0; i < n; i++)
+				numMatched += (static_cast<BenchTarget*>(owner.m_array[int(i)]) == targets[i]);
+		Sample s = { ElapsedNs(start), double(kPasses * n) };
+		Check(numMatched == kPasses * n, "deref", "wrong targets read");
+		return s;
+	}
+
+	// Baseline for deref: read each target the way RefPtr did before it cached
+	// its target, through its RefInfo (m_ref->m_target), two dependent loads
+	Sample BenchDerefUncached(size_t n)
+	{
+		const size_t kPasses = 16;
+		TargetSet targets(n);
+		BenchOwner owner;
+		owner.m_array.SetCount(int(n));
+		for (size_t i = 0; i < n; i++)
+			owner.m_array[int(i)] = targets[i];
+
+		// The RefInfo of each RefPtr, as the RefPtrs hold them.  The array follows m_single
+		std::vector<decltype(owner.GetInfo(0))> infos(n);
+		for (size_t i = 0; i < n; i++)
+			infos[i] = owner.GetInfo(i + 1);
+
+		size_t numMatched = 0;
+		Clock::time_point start = Clock::now();
+		for (size_t pass = 0; pass < kPasses; pass++)
+			for (size_t i = 0; i < n; i++)
+				numMatched += (infos[i]->m_target == targets[i]);
+		Sample s = { ElapsedNs(start), double(kPasses * n) };
+		Check(numMatched == kPasses * n, "deref_uncached", "wrong targets read");
+		return s;
+	}
+
+	// As deref, but through the managers GetReference
+	Sample BenchGetReference(size_t n)
+	{
+		const size_t kPasses = 16;
+		TargetSet targets(n);
+		BenchOwner owner;
+		owner.m_array.SetCount(int(n));
+		for (size_t i = 0; i < n; i++)
+			owner.m_array[int(i)] = targets[i];
+
+		// The array follows m_single
+		size_t numMatched = 0;
+		Clock::time_point start = Clock::now();
+		for (size_t pass = 0; pass < kPasses; pass++)
+			for (size_t i = 0; i < n; i++)
+				numMatched += (owner.GetReference(int(i) + 1) == targets[i]);
+		Sample s = { ElapsedNs(start), double(kPasses * n) };
+		Check(numMatched == kPasses * n, "get_reference", "wrong targets read");
+		return s;
+	}
+
+	// Read both static references of n owners declared by a RefLayout,
+	// with GetReference (STATIC = false) or GetStaticReference
+	template<bool STATIC>
+	Sample BenchGetReferenceLayout(size_t n, const char* name)
+	{
+		const size_t kPasses = 16;
+		TargetSet targets(2);
+		std::vector<SmallOwner<SmallLayout>*> owners(n);
+		for (size_t i = 0; i < n; i++)
+		{
+			owners[i] = new SmallOwner<SmallLayout>;
+			owners[i]->m_first = targets[0];
+			owners[i]->m_second = targets[1];
+		}
+
+		size_t numMatched = 0;
+		Clock::time_point start = Clock::now();
+		for (size_t pass = 0; pass < kPasses; pass++)
+		{
+			for (size_t i = 0; i < n; i++)
+			{
+				if (STATIC)
+					numMatched += (owners[i]->template GetStaticReference<kFirstRef>() == targets[0])
+								+ (owners[i]->template GetStaticReference<kSecondRef>() == targets[1]);
+				else
+					numMatched += (owners[i]->GetReference(kFirstRef) == targets[0])
+								+ (owners[i]->GetReference(kSecondRef) == targets[1]);
+			}
+		}
+		Sample s = { ElapsedNs(start), double(kPasses * 2 * n) };
+		Check(numMatched == kPasses * 2 * n, name, "wrong targets read");
+
+		for (size_t i = 0; i < n; i++)
+			delete owners[i];
+		return s;
+	}
+	Sample BenchGetReferenceLayout(size_t n) { return BenchGetReferenceLayout<false>(n, "get_reference_layout"); }
+	Sample BenchGetStaticReference(size_t n) { return BenchGetReferenceLayout<true>(n, "get_static_reference"); }
+
+	// Finds the only empty slot, the last, with GetReferenceIndex(NULL), which
+	// scans the targets linearly.  Reported per slot scanned
+	Sample BenchScan(size_t n)
+	{
+		const size_t kPasses = 16;
+		TargetSet targets(n);
+		BenchOwner owner;
+		owner.m_single = targets[0];
+		owner.m_array.SetCount(int(n));
+		for (size_t i = 0; i + 1 < n; i++)
+			owner.m_array[int(i)] = targets[i];
+
+		// The array follows m_single
+		size_t numFound = 0;
+		Clock::time_point start = Clock::now();
+		for (size_t pass = 0; pass < kPasses; pass++)
+			numFound += (owner.GetReferenceIndex(static_cast<ReferenceTarget*>(NULL)) == int(n));
+		Sample s = { ElapsedNs(start), double(kPasses * (n + 1)) };
+		Check(numFound == kPasses, "scan", "wrong slot found");
+		return s;
+	}
+
+	// Read each of n targets through the RefArrays view, several times over
+	Sample BenchView(size_t n)
+	{
+		const size_t kPasses = 16;
+		TargetSet targets(n);
+		BenchOwner owner;
+		owner.m_array.SetCount(int(n));
+		for (size_t i = 0; i < n; i++)
+			owner.m_array[int(i)] = targets[i];
+
+		size_t numMatched = 0;
+		Clock::time_point start = Clock::now();
+		for (size_t pass = 0; pass < kPasses; pass++)
+		{
+			RefArrayView<BenchTarget> view = owner.m_array.Targets();
+			for (RefArrayView<BenchTarget>::const_iterator it = view.begin(); it != view.end(); ++it)
+				numMatched += (*it == targets[it - view.begin()]);
+		}
+		Sample s = { ElapsedNs(start), double(kPasses * n) };
+		Check(numMatched == kPasses * n, "view", "wrong targets read");
+		return s;
+	}
+
+#ifdef REFMGR_BENCH_PARALLEL_ALGORITHMS
+	// As view, with std::for_each(std::execution::par) over the view.
+	// Only mismatches touch the shared counter, so it is not contended.
+	Sample BenchViewPar(size_t n)
+	{
+		const size_t kPasses = 16;
+		TargetSet targets(n);
+		BenchOwner owner;
+		owner.m_array.SetCount(int(n));
+		for (size_t i = 0; i < n; i++)
+			owner.m_array[int(i)] = targets[i];
+
+		std::atomic<size_t> numMismatched(0);
+		Clock::time_point start = Clock::now();
+		for (size_t pass = 0; pass < kPasses; pass++)
+		{
+			RefArrayView<BenchTarget> view = owner.m_array.Targets();
+			std::for_each(std::execution::par, view.begin(), view.end(), [&numMismatched](BenchTarget* pTarget) {
+				if (pTarget == NULL)
+					numMismatched.fetch_add(1, std::memory_order_relaxed);
+			});
+		}
+		Sample s = { ElapsedNs(start), double(kPasses * n) };
+		Check(numMismatched == 0, "view_par", "NULL targets read");
+		return s;
+	}
+#endif
+
+	// Baselines for get_reference and scan: the slot table as it was before the
+	// packed target array, one RefInfo pointer per slot, with the target read
+	// from the RefInfo.  GetInfo reads exactly that pointer table.
+	template<typename OWNER_T>
+	ReferenceTarget* GetReferenceAoS(OWNER_T& owner, int i)
+	{
+		auto pInfo = owner.GetInfo(i);
+		return (pInfo != NULL) ? pInfo->m_target : NULL;
+	}
+
+	// As get_reference, through the RefInfo of each slot
+	Sample BenchGetReferenceAoS(size_t n)
+	{
+		const size_t kPasses = 16;
+		TargetSet targets(n);
+		BenchOwner owner;
+		owner.m_array.SetCount(int(n));
+		for (size_t i = 0; i < n; i++)
+			owner.m_array[int(i)] = targets[i];
+
+		// The array follows m_single
+		size_t numMatched = 0;
+		Clock::time_point start = Clock::now();
+		for (size_t pass = 0; pass < kPasses; pass++)
+			for (size_t i = 0; i < n; i++)
+				numMatched += (GetReferenceAoS(owner, int(i) + 1) == targets[i]);
+		Sample s = { ElapsedNs(start), double(kPasses * n) };
+		Check(numMatched == kPasses * n, "get_reference_aos", "wrong targets read");
+		return s;
+	}
+
+	// As scan, through the RefInfo of each slot
+	Sample BenchScanAoS(size_t n)
+	{
+		const size_t kPasses = 16;
+		TargetSet targets(n);
+		BenchOwner owner;
+		owner.m_single = targets[0];
+		owner.m_array.SetCount(int(n));
+		for (size_t i = 0; i + 1 < n; i++)
+			owner.m_array[int(i)] = targets[i];
+
+		// The array follows m_single
+		int numRefs = owner.NumRefs();
+		size_t numFound = 0;
+		Clock::time_point start = Clock::now();
+		for (size_t pass = 0; pass < kPasses; pass++)
+		{
+			int found = -1;
+			for (int i = 0; i < numRefs; i++)
+			{
+				if (GetReferenceAoS(owner, i) == NULL)
+				{
+					found = i;
+					break;
+				}
+			}
+			numFound += (found == int(n));
+		}
+		Sample s = { ElapsedNs(start), double(kPasses * (n + 1)) };
+		Check(numFound == kPasses, "scan_aos", "wrong slot found");
+		return s;
+	}
+
+	// kNumReaders threads each read every one of n references, several
+	// times over, with GetReferenceConcurrent
+	Sample BenchConcurrentRead(size_t n)
+	{
+		const size_t kNumReaders = 4;
+		const size_t kPasses = (n < 100000) ? 100000 / n : 1;	// Enough to hide starting the threads
+		TargetSet targets(n);
+		BenchOwner owner;
+		owner.m_array.SetCount(int(n));
+		for (size_t i = 0; i < n; i++)
+			owner.m_array[int(i)] = targets[i];
+		owner.EnableConcurrentReads(true);
+
+		// The array follows m_single
+		std::vector<size_t> numMatched(kNumReaders, 0);
+		std::vector<std::thread> readers;
+		Clock::time_point start = Clock::now();
+		for (size_t r = 0; r < kNumReaders; r++)
+		{
+			readers.push_back(std::thread([&owner, &targets, &numMatched, kPasses, n, r]() {
+				size_t matched = 0;
+				for (size_t pass = 0; pass < kPasses; pass++)
+					for (size_t i = 0; i < n; i++)
+						matched += (owner.GetReferenceConcurrent(int(i) + 1) == targets[i]);
+				numMatched[r] = matched;
+			}));
+		}
+		for (size_t r = 0; r < kNumReaders; r++)
+			readers[r].join();
+		Sample s = { ElapsedNs(start), double(kNumReaders * kPasses * n) };
+
+		owner.EnableConcurrentReads(false);
+		for (size_t r = 0; r < kNumReaders; r++)
+			Check(numMatched[r] == kPasses * n, "concurrent_read", "wrong targets read");
+		return s;
+	}
+
+	// Each of n referenced targets sends REFMSG_CHANGE to its one dependent
+	Sample BenchNotify(size_t n)
+	{
+		TargetSet targets(n);
+		BenchOwner owner;
+		owner.m_array.SetCount(int(n));
+		for (size_t i = 0; i < n; i++)
+			owner.m_array[int(i)] = targets[i];
+
+		Clock::time_point start = Clock::now();
+		for (size_t i = 0; i < n; i++)
+			targets[i]->NotifyDependents(FOREVER, PART_ALL, REFMSG_CHANGE);
+		Sample s = { ElapsedNs(start), double(n) };
+		Check(owner.m_numNotified == n, "notify", "callbacks were not called");
+		return s;
+	}
+
+	// Delete n targets, each held by two array elements, with the first also
+	// held by the RefPtr.  Every reference to a target must be notified and NULLed.
+	Sample BenchTargetDeleted(size_t n)
+	{
+		std::vector<BenchTarget*> targets(n);
+		BenchOwner owner;
+		owner.m_array.SetCount(int(2 * n));
+		for (size_t i = 0; i < n; i++)
+		{
+			targets[i] = new BenchTarget;
+			owner.m_array[int(i)] = targets[i];
+			owner.m_array[int(n + i)] = targets[i];
+		}
+		owner.m_single = targets[0];
+
+		Clock::time_point start = Clock::now();
+		for (size_t i = 0; i < n; i++)
+			delete targets[i];
+		Sample s = { ElapsedNs(start), double(n) };
+		Check(owner.m_numNotified == 2 * n, "target_deleted", "callbacks were not called");
+		for (int i = 0; i < owner.NumRefs(); i++)
+			Check(owner.GetReference(i) == NULL, "target_deleted", "references were not cleared");
+		return s;
+	}
+
+	// One target sends REFMSG_CHANGE to n dependents
+	Sample BenchFanOut(size_t n)
+	{
+		BenchTarget target;
+		std::vector<BenchOwner*> owners(n);
+		for (size_t i = 0; i < n; i++)
+		{
+			owners[i] = new BenchOwner;
+			owners[i]->m_single = &target;
+		}
+
+		Clock::time_point start = Clock::now();
+		target.NotifyDependents(FOREVER, PART_ALL, REFMSG_CHANGE);
+		Sample s = { ElapsedNs(start), double(n) };
+
+		for (size_t i = n; i > 0; i--)
+			delete owners[i - 1];
+		return s;
+	}
+
+	// Clone n references between two owners.  Every target differs, so every
+	// reference of the destination is replaced.
+	Sample BenchClone(size_t n)
+	{
+		TargetSet fromTargets(n), toTargets(n);
+		BenchOwner from, to;
+		from.m_array.SetCount(int(n));
+		to.m_array.SetCount(int(n));
+		for (size_t i = 0; i < n; i++)
+		{
+			from.m_array[int(i)] = fromTargets[i];
+			to.m_array[int(i)] = toTargets[i];
+		}
+
+		PassThroughRemap remap;
+		Clock::time_point start = Clock::now();
+		from.CloneTo(to, remap);
+		Sample s = { ElapsedNs(start), double(n) };
+		Check(to.m_array[int(n - 1)] == fromTargets[n - 1], "clone", "references were not cloned");
+		return s;
+	}
+
+	// Construct n owners, set their references, then delete them
+	template<typename LAYOUT_T>
+	Sample BenchConstruct(size_t n, const char* name)
+	{
+		BenchTarget target;
+		std::vector<SmallOwner<LAYOUT_T>*> owners(n);
+		Clock::time_point start = Clock::now();
+		for (size_t i = 0; i < n; i++)
+		{
+			SmallOwner<LAYOUT_T>* pOwner = new SmallOwner<LAYOUT_T>;
+			pOwner->m_first = &target;
+			pOwner->m_second = &target;
+			pOwner->m_array.Append(&target);
+			owners[i] = pOwner;
+		}
+		for (size_t i = n; i > 0; i--)
+			delete owners[i - 1];
+		Sample s = { ElapsedNs(start), double(n) };
+		Check(target.NumDependents() == 0, name, "references were not released");
+		return s;
+	}
+	Sample BenchConstructDynamic(size_t n) { return BenchConstruct<DynamicRefLayout>(n, "construct"); }
+	Sample BenchConstructLayout(size_t n) { return BenchConstruct<SmallLayout>(n, "construct_layout"); }
+
+	struct Benchmark
+	{
+		const char* name;
+		const char* description;
+		BenchmarkFn fn;
+	};
+
+	const Benchmark kBenchmarks[] = {
+		{ "register_release",	"RefArray::Append then Delete, one reference at a time",	BenchRegisterRelease },
+		{ "append_concurrent",	"RefArray::Append n times in a DeferNotifyScope, with concurrent reads enabled",	BenchAppendConcurrent },
+		{ "array_resize",		"RefArray::SetCount(n) then SetCount(0)",					BenchArrayResize },
+		{ "assign",				"RefArray element = target, then = NULL",					BenchAssign },
+		{ "deref",				"Read each target through its RefPtr",						BenchDeref },
+		{ "deref_uncached",		"Baseline for deref: read each target through its RefInfo",	BenchDerefUncached },
+		{ "get_reference",		"Read each target through ReferenceManager::GetReference",	BenchGetReference },
+		{ "get_reference_layout",	"GetReference of both static references of n owners with a RefLayout",	BenchGetReferenceLayout },
+		{ "get_static_reference",	"As get_reference_layout, with GetStaticReference<ID>",		BenchGetStaticReference },
+		{ "get_reference_aos",	"Baseline for get_reference: read each target through its RefInfo",	BenchGetReferenceAoS },
+		{ "scan",				"Find the last slot, the only empty one, with GetReferenceIndex(NULL)",	BenchScan },
+		{ "scan_aos",			"Baseline for scan: test each slot through its RefInfo",		BenchScanAoS },
+		{ "view",				"Read each target through RefArray::Targets",				BenchView },
+#ifdef REFMGR_BENCH_PARALLEL_ALGORITHMS
+		{ "view_par",			"As view, with std::for_each(std::execution::par)",			BenchViewPar },
+#endif
+		{ "concurrent_read",	"4 threads read each target with GetReferenceConcurrent",	BenchConcurrentRead },
+		{ "notify",				"n targets each send REFMSG_CHANGE to one owner",			BenchNotify },
+		{ "target_deleted",		"Delete n targets, each held by 2 array elements",			BenchTargetDeleted },
+		{ "fan_out",			"1 target sends REFMSG_CHANGE to n owners",					BenchFanOut },
+		{ "construct",			"Construct and delete n owners of 2 RefPtrs and a RefArray",	BenchConstructDynamic },
+		{ "construct_layout",	"As construct, with the references declared by a RefLayout",	BenchConstructLayout },
+		{ "clone",				"BaseClone between owners with n references",				BenchClone },
+	};
+}
+
+int main(int argc, char** argv)
+{
+	bool quick = false;
+	const char* filter = NULL;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--quick") == 0)
+			quick = true;
+		else
+			filter = argv[i];
+	}
+
+	const size_t kSizes[] = { 10, 100, 1000, 10000, 100000 };
+	const size_t kNumSizes = quick ? 3 : sizeof(kSizes) / sizeof(kSizes[0]);
+	// Roughly the same number of operations at every size, keeping the best run
+	const size_t kOpsPerSize = quick ? 0 : 2000000;
+
+	printf("%-20s %8s %12s\n", "benchmark", "refs", "ns/op");
+	for (size_t b = 0; b < sizeof(kBenchmarks) / sizeof(kBenchmarks[0]); b++)
+	{
+		const Benchmark& bench = kBenchmarks[b];
+		if (filter != NULL && strstr(bench.name, filter) == NULL)
+			continue;
+
+		for (size_t s = 0; s < kNumSizes; s++)
+		{
+			size_t n = kSizes[s];
+			size_t reps = kOpsPerSize / n;
+			if (reps < 1) reps = 1;
+			if (reps > 200) reps = 200;
+
+			double best = 0;
+			for (size_t r = 0; r < reps; r++)
+			{
+				Sample sample = bench.fn(n);
+				double nsPerOp = sample.ns / sample.ops;
+				if (r == 0 || nsPerOp < best)
+					best = nsPerOp;
+			}
+			printf("%-20s %8zu %12.1f\n", bench.name, n, best);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,155 @@
+//
+// Host stand-in for the parts of the 3ds Max core the ReferenceManager uses.
+// See ../README.md
+//
+
+#include "ref.h"
+#include <unordered_map>
+
+Hold theHold;
+
+//------------------------------------------------------------------------
+// Hold
+
+void Hold::Clear()
+{
+	for (size_t i = 0; i < m_objects.size(); i++)
+		delete m_objects[i];
+	m_objects.clear();
+}
+
+void Hold::Begin()
+{
+	Clear();
+	m_holding = true;
+}
+
+void Hold::Accept(const MCHAR* name)
+{
+	UNUSED_PARAM(name);
+	m_holding = false;
+}
+
+void Hold::Cancel()
+{
+	m_holding = false;
+	for (size_t i = m_objects.size(); i > 0; i--)
+		m_objects[i - 1]->Restore(TRUE);
+	Clear();
+}
+
+void Hold::Put(RestoreObj* pObj)
+{
+	if (Holding())
+		m_objects.push_back(pObj);
+	else
+		delete pObj;
+}
+
+void Hold::Undo()
+{
+	Suspend();
+	for (size_t i = m_objects.size(); i > 0; i--)
+		m_objects[i - 1]->Restore(TRUE);
+	Resume();
+	Clear();
+}
+
+//------------------------------------------------------------------------
+// Animatable
+
+namespace
+{
+	AnimHandle s_nextHandle = 1;
+
+	std::unordered_map<AnimHandle, Animatable*>& LiveAnims()
+	{
+		static std::unordered_map<AnimHandle, Animatable*> s_anims;
+		return s_anims;
+	}
+}
+
+Animatable::Animatable()
+	: m_handle(s_nextHandle++)
+{
+	LiveAnims()[m_handle] = this;
+}
+
+Animatable::~Animatable()
+{
+	LiveAnims().erase(m_handle);
+}
+
+AnimHandle Animatable::GetHandleByAnim(Animatable* pAnim)
+{
+	return (pAnim != NULL) ? pAnim->m_handle : 0;
+}
+
+Animatable* Animatable::GetAnimByHandle(AnimHandle handle)
+{
+	std::unordered_map<AnimHandle, Animatable*>::const_iterator it = LiveAnims().find(handle);
+	return (it != LiveAnims().end()) ? it->second : NULL;
+}
+
+//------------------------------------------------------------------------
+// ReferenceMaker
+
+RefResult ReferenceMaker::ReplaceReference(int which, RefTargetHandle newtarg, BOOL delOld)
+{
+	UNUSED_PARAM(delOld);
+	RefTargetHandle oldtarg = GetReference(which);
+	if (oldtarg != NULL)
+		oldtarg->RemoveDependent(this);
+	SetReference(which, newtarg);
+	if (newtarg != NULL)
+		newtarg->AddDependent(this);
+	return REF_SUCCEED;
+}
+
+RefResult ReferenceMaker::DeleteAllRefs()
+{
+	for (int i = NumRefs() - 1; i >= 0; i--)
+	{
+		if (GetReference(i) != NULL)
+			DeleteReference(i);
+	}
+	return REF_SUCCEED;
+}
+
+//------------------------------------------------------------------------
+// ReferenceTarget
+
+void ReferenceTarget::RemoveDependent(ReferenceMaker* pMaker)
+{
+	// References are usually dropped newest first
+	for (size_t i = m_dependents.size(); i > 0; i--)
+	{
+		if (m_dependents[i - 1] == pMaker)
+		{
+			m_dependents.erase(m_dependents.begin() + (i - 1));
+			return;
+		}
+	}
+}
+
+ReferenceTarget::~ReferenceTarget()
+{
+	// Like 3ds Max, our dependents are expected to NULL their
+	// references (without calling ReplaceReference) when told
+	std::vector<ReferenceMaker*> dependents;
+	dependents.swap(m_dependents);
+	PartID partID = PART_ALL;
+	for (size_t i = 0; i < dependents.size(); i++)
+		dependents[i]->NotifyRefChanged(FOREVER, this, partID, REFMSG_TARGET_DELETED, TRUE);
+}
+
+RefResult ReferenceTarget::NotifyDependents(const Interval& changeInt, PartID partID, RefMessage message)
+{
+	// Dependents may be added or removed while we notify
+	for (size_t i = 0; i < m_dependents.size(); i++)
+	{
+		PartID parts = partID;
+		m_dependents[i]->NotifyRefChanged(changeInt, this, parts, message, TRUE);
+	}
+	return REF_SUCCEED;
+}
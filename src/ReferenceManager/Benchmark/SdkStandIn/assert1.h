@@ -0,0 +1,10 @@
+//
+// Host stand-in for the 3ds Max SDK header of the same name.
+// Only what the ReferenceManager headers use is provided, see ../README.md
+//
+
+#pragma once
+
+#include <cassert>
+
+#define DbgAssert(expr) assert(expr)
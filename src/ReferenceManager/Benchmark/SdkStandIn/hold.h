@@ -0,0 +1,58 @@
+//
+// Host stand-in for the 3ds Max SDK header of the same name.
+// Only what the ReferenceManager headers use is provided, see ../README.md
+//
+
+#pragma once
+
+#include "maxtypes.h"
+#include <vector>
+
+class RestoreObj
+{
+public:
+	virtual ~RestoreObj() { }
+	virtual void Restore(int isUndo) = 0;
+	virtual void Redo() = 0;
+	virtual int Size() { return 1; }
+	virtual void EndHold() { }
+	virtual TSTR Description() { return TSTR(_T("---")); }
+};
+
+// The undo stack.  Unlike 3ds Max, this holds a single undo level,
+// which is all the benchmarks need.
+class Hold
+{
+	int m_suspendCount;
+	bool m_holding;
+	std::vector<RestoreObj*> m_objects;	// Of the current (or last accepted) hold
+
+	void Clear();
+
+public:
+	Hold() : m_suspendCount(0), m_holding(false) { }
+	~Hold() { Clear(); }
+
+	void Begin();
+	void Accept(const MCHAR* name);
+	void Cancel();
+	void Put(RestoreObj* pObj);
+	BOOL Holding() { return m_holding && m_suspendCount == 0; }
+	void Suspend() { m_suspendCount++; }
+	void Resume() { m_suspendCount--; }
+
+	/// Undo the last accepted hold, then forget it
+	void Undo();
+};
+
+extern Hold theHold;
+
+class HoldSuspend
+{
+	bool m_suspended;
+public:
+	HoldSuspend(BOOL suspendNow = TRUE) : m_suspended(false) { if (suspendNow) Suspend(); }
+	~HoldSuspend() { Resume(); }
+	void Suspend() { if (!m_suspended) { theHold.Suspend(); m_suspended = true; } }
+	void Resume() { if (m_suspended) { theHold.Resume(); m_suspended = false; } }
+};
@@ -0,0 +1,55 @@
+//
+// Host stand-in for the Windows and 3ds Max SDK base types.
+// Only what the ReferenceManager headers use is provided, see ../README.md
+//
+
+#pragma once
+
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+typedef unsigned char BYTE;
+typedef unsigned int DWORD;
+typedef int BOOL;
+typedef uintptr_t ULONG_PTR;
+
+#ifndef TRUE
+#define TRUE 1
+#define FALSE 0
+#endif
+
+typedef char MCHAR;
+typedef std::string TSTR;
+#define _T(x) x
+
+#define UNUSED_PARAM(x) (void)(x)
+
+typedef int TimeValue;
+#define TIME_NegInfinity TimeValue(0x80000000)
+#define TIME_PosInfinity TimeValue(0x7fffffff)
+
+class Interval
+{
+	TimeValue m_start;
+	TimeValue m_end;
+public:
+	Interval(TimeValue start, TimeValue end) : m_start(start), m_end(end) { }
+	Interval() : m_start(0), m_end(-1) { }
+
+	TimeValue Start() const { return m_start; }
+	TimeValue End() const { return m_end; }
+
+	Interval& operator&=(const Interval& rhs)
+	{
+		if (rhs.m_start > m_start) m_start = rhs.m_start;
+		if (rhs.m_end < m_end) m_end = rhs.m_end;
+		return *this;
+	}
+	bool operator==(const Interval& rhs) const { return m_start == rhs.m_start && m_end == rhs.m_end; }
+};
+
+#define FOREVER Interval(TIME_NegInfinity, TIME_PosInfinity)
+#define NEVER Interval(TIME_NegInfinity, TIME_NegInfinity)
@@ -0,0 +1,9 @@
+//
+// Host stand-in for the 3ds Max SDK header of the same name.
+// Only what the ReferenceManager headers use is provided, see ../README.md
+//
+
+#pragma once
+
+// Build against the current NotifyRefChanged signature (3ds Max 2015 and later)
+#define MAX_VERSION_MAJOR 25
@@ -0,0 +1,107 @@
+//
+// Host stand-in for the 3ds Max SDK header of the same name.
+// Only what the ReferenceManager headers use is provided, see ../README.md
+//
+// The reference graph behaves like 3ds Max's in the ways the ReferenceManager
+// depends on: ReplaceReference maintains the targets dependents and calls
+// SetReference, NotifyDependents calls NotifyRefChanged on every dependent,
+// and deleting a target sends REFMSG_TARGET_DELETED to its dependents.
+// There is no undo of reference changes, and no circular reference check.
+//
+
+#pragma once
+
+#include "maxtypes.h"
+#include "hold.h"
+#include "tab.h"
+#include <vector>
+
+typedef ULONG_PTR PartID;
+typedef unsigned int RefMessage;
+typedef ULONG_PTR AnimHandle;
+
+#define PART_ALL							0xffffffff
+
+#define REFMSG_TARGET_DELETED				0x00000002
+#define REFMSG_CHANGE						0x00000021
+#define REFMSG_BEGIN_EDIT					0x00000060
+#define REFMSG_END_EDIT						0x00000070
+#define REFMSG_NODE_NAMECHANGE				0x000000e8
+#define REFMSG_SUBANIM_STRUCTURE_CHANGED	0x000000f1
+#define REFMSG_USER							0x00010000
+
+enum RefResult
+{
+	REF_FAIL,
+	REF_SUCCEED,
+	REF_DONTCARE,
+	REF_STOP,
+	REF_INVALID,
+};
+
+class ReferenceTarget;
+class ReferenceMaker;
+typedef ReferenceTarget* RefTargetHandle;
+typedef ReferenceMaker* RefMakerHandle;
+
+class Animatable
+{
+	AnimHandle m_handle;
+
+	Animatable(const Animatable&);
+	Animatable& operator=(const Animatable&);
+public:
+	Animatable();
+	virtual ~Animatable();
+
+	/// Handles are never reused, and resolve to NULL once the animatable is deleted
+	static AnimHandle GetHandleByAnim(Animatable* pAnim);
+	static Animatable* GetAnimByHandle(AnimHandle handle);
+};
+
+class RemapDir
+{
+public:
+	virtual ~RemapDir() { }
+	virtual RefTargetHandle CloneRef(RefTargetHandle oldTarg) = 0;
+};
+
+class ReferenceMaker : public Animatable
+{
+	friend class ReferenceTarget;
+public:
+	virtual int NumRefs() { return 0; }
+	virtual RefTargetHandle GetReference(int i) { UNUSED_PARAM(i); return NULL; }
+
+	RefResult ReplaceReference(int which, RefTargetHandle newtarg, BOOL delOld = TRUE);
+	RefResult DeleteReference(int which) { return ReplaceReference(which, NULL); }
+	RefResult DeleteAllRefs();
+
+	virtual BOOL IsRealDependency(ReferenceTarget* rtarg) { UNUSED_PARAM(rtarg); return TRUE; }
+	virtual BOOL ShouldPersistWeakRef(ReferenceTarget* rtarg) { UNUSED_PARAM(rtarg); return FALSE; }
+	virtual void BaseClone(ReferenceTarget* from, ReferenceTarget* to, RemapDir& remap) { UNUSED_PARAM(from); UNUSED_PARAM(to); UNUSED_PARAM(remap); }
+
+protected:
+	virtual void SetReference(int i, RefTargetHandle rtarg) { UNUSED_PARAM(i); UNUSED_PARAM(rtarg); }
+	virtual RefResult NotifyRefChanged(const Interval& changeInt, RefTargetHandle hTarget, PartID& partID, RefMessage message, BOOL propagate) = 0;
+};
+
+class ReferenceTarget : public ReferenceMaker
+{
+	friend class ReferenceMaker;
+
+	// One entry per reference to us, in the order they were made
+	std::vector<ReferenceMaker*> m_dependents;
+	void AddDependent(ReferenceMaker* pMaker) { m_dependents.push_back(pMaker); }
+	void RemoveDependent(ReferenceMaker* pMaker);
+
+public:
+	/// Sends REFMSG_TARGET_DELETED to every dependent
+	virtual ~ReferenceTarget();
+
+	/// Sends message to every dependent
+	RefResult NotifyDependents(const Interval& changeInt, PartID partID, RefMessage message);
+
+	/// The number of references to us
+	int NumDependents() const { return int(m_dependents.size()); }
+};
@@ -0,0 +1,103 @@
+//
+// Host stand-in for the 3ds Max SDK header of the same name.
+// Only what the ReferenceManager headers use is provided, see ../README.md
+//
+// Like the SDK's Tab, items are raw memory: they are never constructed,
+// destructed or copied by anything but memcpy/memmove/realloc.
+//
+
+#pragma once
+
+#include "maxtypes.h"
+#include <cstdlib>
+
+typedef int (*CompareFnc)(const void* item1, const void* item2);
+
+template<class T>
+class Tab
+{
+	T* m_data;
+	int m_count;
+	int m_capacity;
+
+	void Reserve(int capacity)
+	{
+		if (capacity <= m_capacity)
+			return;
+		m_data = static_cast<T*>(realloc(m_data, capacity * sizeof(T)));
+		m_capacity = capacity;
+	}
+
+public:
+	Tab() : m_data(NULL), m_count(0), m_capacity(0) { }
+	Tab(const Tab& rhs) : m_data(NULL), m_count(0), m_capacity(0) { *this = rhs; }
+	~Tab() { free(m_data); }
+
+	Tab& operator=(const Tab& rhs)
+	{
+		if (this != &rhs)
+		{
+			SetCount(rhs.m_count);
+			if (m_count > 0)
+				memcpy(m_data, rhs.m_data, m_count * sizeof(T));
+		}
+		return *this;
+	}
+
+	void Init() { free(m_data); m_data = NULL; m_count = m_capacity = 0; }
+	int Count() const { return m_count; }
+	void ZeroCount() { m_count = 0; }
+
+	bool SetCount(int n, BOOL resize = TRUE)
+	{
+		if (n > m_capacity)
+			Reserve(resize ? n : m_capacity * 2 > n ? m_capacity * 2 : n);
+		m_count = n;
+		return true;
+	}
+
+	T* Addr(int i) const { return m_data + i; }
+	T& operator[](int i) const { return m_data[i]; }
+
+	int Insert(int at, int num, T* el)
+	{
+		Reserve(m_count + num);
+		memmove(m_data + at + num, m_data + at, (m_count - at) * sizeof(T));
+		if (el != NULL)
+			memcpy(m_data + at, el, num * sizeof(T));
+		m_count += num;
+		return at;
+	}
+
+	int Append(int num, T* el, int allocExtra = 0)
+	{
+		Reserve(m_count + num + allocExtra);
+		return Insert(m_count, num, el);
+	}
+
+	int Delete(int start, int num)
+	{
+		memmove(m_data + start, m_data + start + num, (m_count - start - num) * sizeof(T));
+		m_count -= num;
+		return m_count;
+	}
+
+	// Set the capacity (not the count)
+	int Resize(int num)
+	{
+		if (num < m_count)
+			m_count = num;
+		if (num == 0)
+		{
+			Init();
+			return 1;
+		}
+		m_data = static_cast<T*>(realloc(m_data, num * sizeof(T)));
+		m_capacity = num;
+		return 1;
+	}
+
+	void Shrink() { Resize(m_count); }
+
+	void Sort(CompareFnc cmp) { qsort(m_data, m_count, sizeof(T), cmp); }
+};
@@ -0,0 +1,206 @@
+//
+// Copyright 2009 Autodesk, Inc.  All rights reserved.
+//
+// Use of this software is subject to the terms of the Autodesk license
+// agreement provided at the time of installation or download, or which
+// otherwise accompanies this software in either electronic or hard copy form.
+//
+
+#pragma once
+
+// std::atomic and std::thread need Visual Studio 2012 (v110) or later.
+// With older compilers, ReferenceManager has no concurrent reads.
+#if !defined(_MSC_VER) || _MSC_VER > 1600
+#define REFMGR_HAS_CONCURRENT_READS
+#endif
+
+#ifdef REFMGR_HAS_CONCURRENT_READS
+
+#include <assert1.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <thread>
+#include <vector>
+
+class ReferenceTarget;
+
+//=========================================================
+/// Publishes immutable copies of a list of targets, for other threads to read.
+///
+/// The main thread publishes a new copy after each change.  Readers use a
+/// Reader, which keeps the copy that was current when it was made alive
+/// until the Reader is destroyed.  Readers never take a lock.
+///
+/// Each Reader protects its copy with a hazard slot that it has claimed for
+/// itself.  Every slot is on its own cache line, and threads start looking
+/// for a free slot at different places, so readers on different threads do
+/// not write to the same memory.  Replaced copies are freed when the next
+/// copy is published, unless a slot still holds them.  So no more than
+/// kNumSlots replaced copies are ever kept.  If more than kNumSlots readers
+/// are reading at once, the extra ones wait for a slot.
+///
+/// Only Reader is thread-safe.  Everything else must be called from the
+/// main thread.
+class ConcurrentTargets
+{
+private:
+	// An immutable copy of the targets
+	struct Snapshot
+	{
+		size_t m_numTargets;
+		ReferenceTarget* m_targets[1];	// Actually m_numTargets long
+	};
+
+public:
+	enum { kNumSlots = 64 };
+
+	/// Reads the copy that was current when it was constructed
+	class Reader
+	{
+	public:
+		explicit Reader(ConcurrentTargets& targets);
+		~Reader() { m_pSlot->store(NULL, std::memory_order_release); }
+
+		size_t NumTargets() const { return m_pSnapshot->m_numTargets; }
+		ReferenceTarget* GetTarget(size_t pos) const { return (pos < m_pSnapshot->m_numTargets) ? m_pSnapshot->m_targets[pos] : NULL; }
+
+	private:
+		std::atomic<void*>* m_pSlot;
+		const Snapshot* m_pSnapshot;
+
+		Reader(const Reader&);
+		Reader& operator=(const Reader&);
+	};
+
+	/// Publishes a copy of pTargets[0, numTargets)
+	ConcurrentTargets(ReferenceTarget* const* pTargets, size_t numTargets)
+		: m_pCurrent(NewSnapshot(pTargets, numTargets))
+		, m_dirty(false)
+	{
+		for (size_t i = 0; i < kNumSlots; i++)
+			m_slots[i].m_pSnapshot.store(NULL);
+	}
+
+	/// No Reader may still exist
+	~ConcurrentTargets()
+	{
+		DbgAssert(!HasReaders() && "ERROR: Concurrent reads disabled while a thread is reading");
+		for (size_t i = 0; i < m_retired.size(); i++)
+			FreeSnapshot(m_retired[i]);
+		FreeSnapshot(m_pCurrent.load());
+	}
+
+	/// Publishes a copy of pTargets[0, numTargets), and frees the
+	/// replaced copies that no Reader is using
+	void Publish(ReferenceTarget* const* pTargets, size_t numTargets)
+	{
+		m_dirty = false;
+		m_retired.push_back(m_pCurrent.exchange(NewSnapshot(pTargets, numTargets)));
+		Reclaim();
+	}
+
+	/// Records that the targets have changed since the last Publish
+	void MarkDirty() { m_dirty = true; }
+	bool IsDirty() const { return m_dirty; }
+
+	/// Returns true if any Reader exists
+	bool HasReaders() const
+	{
+		for (size_t i = 0; i < kNumSlots; i++)
+			if (m_slots[i].m_pSnapshot.load() != NULL)
+				return true;
+		return false;
+	}
+
+private:
+	// Padded out to a cache line, so no two slots share one
+	struct HazardSlot
+	{
+		std::atomic<void*> m_pSnapshot;		// The Snapshot a Reader is using, or NULL if the slot is free
+		char m_pad[64 - sizeof(std::atomic<void*>)];
+	};
+
+	std::atomic<Snapshot*> m_pCurrent;		// The most recently published copy
+	std::vector<Snapshot*> m_retired;		// Replaced copies a Reader was using when last checked
+	bool m_dirty;
+	HazardSlot m_slots[kNumSlots];
+
+	ConcurrentTargets(const ConcurrentTargets&);
+	ConcurrentTargets& operator=(const ConcurrentTargets&);
+
+	static Snapshot* NewSnapshot(ReferenceTarget* const* pTargets, size_t numTargets)
+	{
+		size_t bytes = sizeof(Snapshot) + (numTargets > 0 ? numTargets - 1 : 0) * sizeof(ReferenceTarget*);
+		Snapshot* pSnapshot = static_cast<Snapshot*>(::operator new(bytes));
+		pSnapshot->m_numTargets = numTargets;
+		if (numTargets > 0)
+			memcpy(pSnapshot->m_targets, pTargets, numTargets * sizeof(ReferenceTarget*));
+		return pSnapshot;
+	}
+
+	static void FreeSnapshot(Snapshot* pSnapshot) { ::operator delete(pSnapshot); }
+
+	// Free every retired copy that is not in a hazard slot.  A Reader only
+	// uses a copy after seeing it is still current with the copy already in
+	// its slot, and retired copies are no longer current.  So a copy that is
+	// in no slot now can never be used again.
+	void Reclaim()
+	{
+		void* held[kNumSlots];
+		size_t numHeld = 0;
+		for (size_t i = 0; i < kNumSlots; i++)
+		{
+			void* p = m_slots[i].m_pSnapshot.load();
+			if (p != NULL)
+				held[numHeld++] = p;
+		}
+
+		size_t numKept = 0;
+		for (size_t i = 0; i < m_retired.size(); i++)
+		{
+			if (std::find(held, held + numHeld, static_cast<void*>(m_retired[i])) != held + numHeld)
+				m_retired[numKept++] = m_retired[i];
+			else
+				FreeSnapshot(m_retired[i]);
+		}
+		m_retired.resize(numKept);
+	}
+};
+
+inline ConcurrentTargets::Reader::Reader(ConcurrentTargets& targets)
+{
+	// Claim a free slot, starting at one chosen by our thread so
+	// that threads reading at the same time use different slots
+	Snapshot* pSnapshot = targets.m_pCurrent.load();
+	size_t i = std::hash<std::thread::id>()(std::this_thread::get_id());
+	for (size_t numTried = 0; ; numTried++, i++)
+	{
+		if (numTried > 0 && numTried % kNumSlots == 0)
+			std::this_thread::yield();	// Every slot is in use
+
+		std::atomic<void*>& slot = targets.m_slots[i % kNumSlots].m_pSnapshot;
+		void* pFree = NULL;
+		if (slot.load(std::memory_order_relaxed) == NULL && slot.compare_exchange_strong(pFree, pSnapshot))
+		{
+			m_pSlot = &slot;
+			break;
+		}
+	}
+
+	// pSnapshot may have been replaced, and even freed, before our slot held it.
+	// Once it is still current after our slot holds it, it is safe to read.
+	for (;;)
+	{
+		Snapshot* pCurrent = targets.m_pCurrent.load();
+		if (pCurrent == pSnapshot)
+			break;
+		pSnapshot = pCurrent;
+		m_pSlot->store(pSnapshot);
+	}
+	m_pSnapshot = pSnapshot;
+}
+
+#endif // REFMGR_HAS_CONCURRENT_READS
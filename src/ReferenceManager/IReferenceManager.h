@@ -23,6 +23,58 @@ NotifyCallback* MakeNotifyCallback(Y* x, RetType (X::*func)(Param1 p1, Param2 p2
 	return new fastdelegate::FastDelegate2<Param1, Param2, RetType>(x, func);
 }
 
+// A RefArray may instead share one callback between all its references.
+// This also receives the index in the array of the reference being notified.
+typedef fastdelegate::FastDelegate3<int, RefMessage, PartID&, RefResult> ArrayNotifyCallback;
+
+template <class X, class Y>
+ArrayNotifyCallback MakeArrayNotifyCallback(Y* x, RefResult (X::*func)(int index, RefMessage msg, PartID& partID)) { 
+	return ArrayNotifyCallback(x, func);
+}
+
+// RefMessages are plain values, not bit flags, so callbacks choose which
+// messages they receive by these categories instead.  Any message not
+// listed explicitly falls into kRefMsgUser or kRefMsgOther.
+enum RefMessageType
+{
+	kRefMsgChange,					// REFMSG_CHANGE
+	kRefMsgTargetDeleted,			// REFMSG_TARGET_DELETED
+	kRefMsgSubAnimStructureChanged,	// REFMSG_SUBANIM_STRUCTURE_CHANGED
+	kRefMsgNodeNameChange,			// REFMSG_NODE_NAMECHANGE
+	kRefMsgEdit,					// REFMSG_BEGIN_EDIT, REFMSG_END_EDIT
+	kRefMsgUser,					// REFMSG_USER and above
+	kRefMsgOther,					// Everything else
+	kNumRefMsgTypes
+};
+
+// A set of RefMessageTypes, used to filter the messages a callback receives
+enum RefMessageFilter
+{
+	kRefMsgFilterChange				= 1 << kRefMsgChange,
+	kRefMsgFilterTargetDeleted		= 1 << kRefMsgTargetDeleted,
+	kRefMsgFilterSubAnimStructure	= 1 << kRefMsgSubAnimStructureChanged,
+	kRefMsgFilterNodeNameChange		= 1 << kRefMsgNodeNameChange,
+	kRefMsgFilterEdit				= 1 << kRefMsgEdit,
+	kRefMsgFilterUser				= 1 << kRefMsgUser,
+	kRefMsgFilterOther				= 1 << kRefMsgOther,
+	kRefMsgFilterAll				= (1 << kNumRefMsgTypes) - 1
+};
+
+// Return the category a message falls into
+inline RefMessageType GetRefMessageType(RefMessage message)
+{
+	switch (message)
+	{
+	case REFMSG_CHANGE:						return kRefMsgChange;
+	case REFMSG_TARGET_DELETED:				return kRefMsgTargetDeleted;
+	case REFMSG_SUBANIM_STRUCTURE_CHANGED:	return kRefMsgSubAnimStructureChanged;
+	case REFMSG_NODE_NAMECHANGE:			return kRefMsgNodeNameChange;
+	case REFMSG_BEGIN_EDIT:
+	case REFMSG_END_EDIT:					return kRefMsgEdit;
+	}
+	return (message >= REFMSG_USER) ? kRefMsgUser : kRefMsgOther;
+}
+
 //=========================================================
 /// This class provides a template-free interface from RefPtr to ReferenceManager
 /// Developers should not derive directly from this
@@ -56,16 +108,36 @@ protected:
 		RefInfo(const RefInfo& ); // No copy constructor!
 
 	public:
+		// Whether a reference is weak or persisted is stored by the manager
+		// alongside its target, see ReferenceManager::kSlotFlags.
 		enum kRefFlags // describes the state of this reference
 		{
-			kIsWeak			= 1 << 0,	// Weak Reference
-			kIsPersisted	= 1 << 1,	// Is the reference saved/loaded?
-			kNumFlags					// Once released, we cannot assign/read this reference
+			kIsPending		= 1 << 0,	// Has a deferred REFMSG_CHANGE waiting to be delivered
+			kIsDirty		= 1 << 1,	// Has changed since the owner last acknowledged it
+			kNumFlags					// Not a flag, this follows the last one
 		};
 
 		DWORD m_flags;				// stores our current state
-		ReferenceTarget* m_target;	// Stores our current pointer.
+		int m_dirtyIdx;				// While kIsDirty, our index in the managers dirty list, which holds
+									// the changes accumulated since the owner last acknowledged them
+		ReferenceTarget* m_target;	// Stores our current pointer.  This is a copy of the managers
+									// packed slot table, kept so RefPtr can read it without the manager.
 		NotifyCallback* m_callback; // A callback for the client to recieve reference messages
+		int m_slot;					// Our current reference index on the manager.  Only the manager
+									// may change this, it is updated whenever its references shift.
+		DWORD m_messageFilter;		// The RefMessageFilter of messages m_callback wants to receive
+		PartID m_pendingParts;		// While kIsPending, the PartIDs of every deferred REFMSG_CHANGE OR'd together
+		const ArrayNotifyCallback* m_arrayCallback;	// The callback shared by every reference in our RefArray.  
+									// Not owned, this is used instead of m_callback if set.
+		ReferenceTarget** m_pTargetCache;	// If set, a copy of m_target held by our RefPtr, so it can read
+									// its target with a single load.  Updated whenever m_target is.
+		RefInfo* m_pNextSameTarget;	// The other references to m_target are chained through these.
+		RefInfo* m_pPrevSameTarget;	// Only the managers target index may change them, see TargetIndex.
+#ifdef REFMGR_ENABLE_STATS
+		// Instrumentation only, see RefMgrStats.h
+		DWORD m_numDispatched;		// How many messages have been passed to m_callback
+		DWORD m_numFiltered;		// How many messages were not passed to m_callback because of m_messageFilter
+#endif
 
 		// Flag write access is private
 		void SetFlag(kRefFlags flag)	{ m_flags |= flag; }
@@ -73,21 +145,40 @@ protected:
 		bool TestFlag(kRefFlags flag)	{ return (m_flags&flag) != 0; }
 
 		RefInfo() 
-			: m_target(NULL), m_flags(0), m_callback(NULL)
+			: m_target(NULL), m_flags(0), m_dirtyIdx(-1), m_callback(NULL), m_slot(-1)
+			, m_messageFilter(kRefMsgFilterAll), m_pendingParts(0)
+			, m_arrayCallback(NULL), m_pTargetCache(NULL)
+			, m_pNextSameTarget(NULL), m_pPrevSameTarget(NULL)
+#ifdef REFMGR_ENABLE_STATS
+			, m_numDispatched(0), m_numFiltered(0)
+#endif
 		{ }
 
 		// The standard constructor.  When creating a RefInfo, this
 		// is the constructor that is usually used.
 		RefInfo(ReferenceTarget* target, NotifyCallback* callback, int flags)
-			: m_target(target), m_callback(callback), m_flags(flags)
+			: m_target(target), m_callback(callback), m_flags(flags), m_dirtyIdx(-1), m_slot(-1)
+			, m_messageFilter(kRefMsgFilterAll), m_pendingParts(0)
+			, m_arrayCallback(NULL), m_pTargetCache(NULL)
+			, m_pNextSameTarget(NULL), m_pPrevSameTarget(NULL)
+#ifdef REFMGR_ENABLE_STATS
+			, m_numDispatched(0), m_numFiltered(0)
+#endif
 		{ }
 
+		// The manager must set our target through here, to keep the RefPtrs copy current
+		void SetTarget(ReferenceTarget* target)
+		{
+			m_target = target;
+			if (m_pTargetCache != NULL)
+				*m_pTargetCache = target;
+		}
+
 		// We own our m_callback member.  If we are deleted, delete it too
 		~RefInfo() { delete m_callback; }
 
-		// Provide accessors for these functions to enforce we do not modify data on a released class
-		void SetIsPersisted(bool v) { (v) ? SetFlag(kIsPersisted) : ClearFlag(kIsPersisted); }
-		void SetIsWeak(bool v) { (v) ? SetFlag(kIsWeak) : ClearFlag(kIsWeak); }
+		// Does anyone want our messages?
+		bool HasCallback() const { return m_callback != NULL || m_arrayCallback != NULL; }
 	};
 #endif
 #pragma endregion // RefInfo class 
@@ -109,8 +200,9 @@ protected:
 	\param pTarget - The new reference target */
 	virtual void SetRef(size_t n, ReferenceTarget* pTarget) = 0;
 
-	/**Find the first index with the given reference target assigned.
-		This function _must_ succeed */
+	/**Return the reference index of the given RefInfo.
+		This function _must_ succeed.  It does not search, the index
+		is read from the RefInfo itself (see RefInfo::m_slot) */
 	virtual int GetReferenceIndex(RefInfo* pRefInfo) = 0;
 
 protected:
@@ -156,8 +248,28 @@ protected:
 	\param ref - An initial value to set our reference to.
 	\param isWeak - Specifies the new reference to be a 'weak' reference.  See ReferenceMaker::IsRealDependency
 	\param isPersisted - Specifies the reference as temporary (not saved).  See ReferenceMaker::ShouldPersistWeakRef
+	\param messageFilter - The RefMessageFilter of messages to pass to callback.  Other messages are not sent to it.
 	\return The RefInfo structure for the newly created reference if successful, else NULL */
-	virtual RefInfo* RegisterReference(size_t baseId, int index, NotifyCallback* callback, ReferenceTarget* ref=NULL, bool isWeak = false, bool isPersisted = true)  = 0;
+	virtual RefInfo* RegisterReference(size_t baseId, int index, NotifyCallback* callback, ReferenceTarget* ref=NULL, bool isWeak = false, bool isPersisted = true, DWORD messageFilter = kRefMsgFilterAll)  = 0;
+
+	/** Directly calling this function is NOT recommended, See Instead RefArray
+	Registers 'count' new (NULL) references in the array baseId, at the contiguous
+	indices [index, index + count) of that array.  This is equivalent to calling
+	RegisterReference count times, but the references above the new ones are
+	shifted only once, so growing an array by n is O(n) rather than O(n * NumRefs()).
+	\param baseId - The id of the reference array.  This must be an array, see RegisterReferenceArray.
+	\param index - The index in the array of the first new reference.  -1 appends to the end of the array.
+	\param count - The number of references to register
+	\param callback - If not NULL, each new reference receives its own copy of this callback.
+						The caller retains ownership of callback itself.
+	\param outInfos - An array of at least count entries, which receives the RefInfo of each new reference.
+	\param isWeak - Specifies the new references to be 'weak' references.  See ReferenceMaker::IsRealDependency
+	\param isPersisted - Specifies the references as temporary (not saved).  See ReferenceMaker::ShouldPersistWeakRef
+	\param messageFilter - The RefMessageFilter of messages to pass to each callback.
+	\param sharedCallback - If not NULL, used instead of callback.  Every new reference points to this
+						one callback, no copies are made, so it must outlive the references.
+	\return true if successful */
+	virtual bool RegisterReferences(size_t baseId, int index, int count, const NotifyCallback* callback, RefInfo** outInfos, bool isWeak = false, bool isPersisted = true, DWORD messageFilter = kRefMsgFilterAll, const ArrayNotifyCallback* sharedCallback = NULL) = 0;
 
 	/** Directly calling this function is NOT recommended, See Instead RefPtr & RefArray
 	This is only necessary if the user is implementing dynamic reference management.
@@ -173,4 +285,47 @@ protected:
 	\param baseId - The Id of the reference group this RefInfo was registered in. 
 		\sa RefPtr::BASE_ID and RefArray::BASE_ID */
 	virtual RefResult ReleaseReference(RefInfo* pInfo, size_t baseId) = 0;
+
+	/** Directly calling this function is NOT recommended, See Instead RefArray
+	Releases 'count' contiguous references in the array baseId, starting with pFirst.
+	This is equivalent to calling ReleaseReference on each of them, but the references
+	above them are shifted once, and the array size is updated once.
+	All released RefInfos are deleted and must not be used again.
+	\param pFirst - The RefInfo of the lowest-indexed reference to release.
+	\param count - The number of references to release.  
+	\param baseId - The Id of the reference array these references were registered in. */
+	virtual RefResult ReleaseReferences(RefInfo* pFirst, int count, size_t baseId) = 0;
+
+	/** Directly calling this function is NOT recommended, See Instead RefArray
+	Releases 'count' references in the array baseId, in any order and not necessarily
+	contiguous.  This is equivalent to calling ReleaseReference on each of them, but
+	the remaining references are shifted down in a single pass, and the array size 
+	is updated once.  All released RefInfos are deleted and must not be used again.
+	\param ppInfos - The RefInfos of the references to release.
+	\param count - The number of references in ppInfos.  
+	\param baseId - The Id of the reference array these references were registered in. */
+	virtual RefResult ReleaseReferences(RefInfo** ppInfos, int count, size_t baseId) = 0;
+
+	/** Directly calling this function is NOT recommended, See Instead RefArray::Sort
+	Reorders the references [index, index + count) in the array baseId, without
+	releasing them or changing their targets.  Afterwards, the reference at 
+	index + i is the one that was at index + pOrder[i].  Each RefInfo is moved
+	to its new index, so nothing else needs to be updated.
+	This is not undoable, nor are dependents notified.
+	\param baseId - The Id of the reference array to reorder.
+	\param index - The index in the array of the first reference to reorder.
+	\param count - The number of references to reorder.
+	\param pOrder - A permutation of [0, count)
+	\return true if the references were reordered. */
+	virtual bool PermuteReferences(size_t baseId, int index, int count, const int* pOrder) = 0;
+
+	/** Directly calling this function is NOT recommended, See Instead RefArray::Targets
+	Returns the targets of every reference in the array baseId.  The targets of an
+	array are stored contiguously, so this returns a pointer into that storage.
+	Nothing is copied.  The pointer is valid until any reference is next registered,
+	released or reordered.
+	\param baseId - The Id of the reference array.
+	\param count - Receives the number of references in the array.
+	\return The target of the first reference in the array, or NULL if it is empty. */
+	virtual ReferenceTarget* const* GetArrayTargets(size_t baseId, int& count) = 0;
 };
\ No newline at end of file
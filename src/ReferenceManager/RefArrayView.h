@@ -0,0 +1,104 @@
+//
+// Copyright 2009 Autodesk, Inc.  All rights reserved.
+//
+// Use of this software is subject to the terms of the Autodesk license
+// agreement provided at the time of installation or download, or which
+// otherwise accompanies this software in either electronic or hard copy form.
+//
+
+#pragma once
+
+#include <assert1.h>
+#include <cstddef>
+#include <iterator>
+
+class ReferenceTarget;
+
+//=========================================================
+/// A read-only, non-owning view of the targets of a RefArray.
+///
+/// The view reads the targets directly from the ReferenceManager's
+/// packed storage, so creating one copies nothing, and reading an
+/// element is a single load (and a static_cast to REF_TYPE_T).
+/// The storage holds ReferenceTarget pointers, so elements are returned
+/// by value (as REF_TYPE_T*), not by reference.  The iterators are
+/// random access proxy iterators: every random access operation is
+/// supported, but dereferencing yields a value.  So they work with
+/// range-for and the read-only standard algorithms, including the
+/// parallel ones, which split the range by index.  Nothing can be
+/// written through them, so algorithms that reorder (std::sort) do not apply.
+/// \code
+/// for (INode* pNode : m_nodes.Targets())
+///		...
+/// RefArrayView<INode> nodes = m_nodes.Targets();
+/// std::for_each(std::execution::par, nodes.begin(), nodes.end(), [](INode* pNode) { ... });
+/// \endcode
+/// The view is invalidated when any reference of the owning manager
+/// is registered, released or reordered.  Changing the target of
+/// an existing reference is visible through the view.
+template<typename REF_TYPE_T>
+class RefArrayView
+{
+public:
+	class const_iterator
+	{
+	private:
+		ReferenceTarget* const* m_p;
+	public:
+		// A proxy iterator: reference is the value itself, not a REF_TYPE_T*&
+		typedef std::random_access_iterator_tag iterator_category;
+		typedef REF_TYPE_T* value_type;
+		typedef ptrdiff_t difference_type;
+		typedef void pointer;
+		typedef REF_TYPE_T* reference;
+
+		const_iterator() : m_p(NULL) { }
+		explicit const_iterator(ReferenceTarget* const* p) : m_p(p) { }
+
+		// Every target was validated as a REF_TYPE_T when it was assigned
+		REF_TYPE_T* operator*() const { return static_cast<REF_TYPE_T*>(*m_p); }
+		REF_TYPE_T* operator[](difference_type n) const { return static_cast<REF_TYPE_T*>(m_p[n]); }
+
+		const_iterator& operator++() { ++m_p; return *this; }
+		const_iterator operator++(int) { const_iterator tmp(*this); ++m_p; return tmp; }
+		const_iterator& operator--() { --m_p; return *this; }
+		const_iterator operator--(int) { const_iterator tmp(*this); --m_p; return tmp; }
+		const_iterator& operator+=(difference_type n) { m_p += n; return *this; }
+		const_iterator& operator-=(difference_type n) { m_p -= n; return *this; }
+		const_iterator operator+(difference_type n) const { return const_iterator(m_p + n); }
+		const_iterator operator-(difference_type n) const { return const_iterator(m_p - n); }
+		friend const_iterator operator+(difference_type n, const const_iterator& it) { return it + n; }
+		difference_type operator-(const const_iterator& rhs) const { return m_p - rhs.m_p; }
+
+		bool operator==(const const_iterator& rhs) const { return m_p == rhs.m_p; }
+		bool operator!=(const const_iterator& rhs) const { return m_p != rhs.m_p; }
+		bool operator<(const const_iterator& rhs) const { return m_p < rhs.m_p; }
+		bool operator>(const const_iterator& rhs) const { return m_p > rhs.m_p; }
+		bool operator<=(const const_iterator& rhs) const { return m_p <= rhs.m_p; }
+		bool operator>=(const const_iterator& rhs) const { return m_p >= rhs.m_p; }
+	};
+	typedef const_iterator iterator;
+
+private:
+	ReferenceTarget* const* m_pTargets;
+	int m_count;
+
+public:
+	RefArrayView(ReferenceTarget* const* pTargets, int count)
+		: m_pTargets(pTargets), m_count(count)
+	{ }
+
+	/// The number of targets in the view
+	int Count() const { return m_count; }
+	bool empty() const { return m_count == 0; }
+
+	/// Read target i.  No range checking is done in release builds.
+	REF_TYPE_T* operator[](int i) const
+	{
+		DbgAssert(i >= 0 && i < m_count);
+		return static_cast<REF_TYPE_T*>(m_pTargets[i]);
+	}
+
+	const_iterator begin() const { return const_iterator(m_pTargets); }
+	const_iterator end() const { return const_iterator(m_pTargets + m_count); }
+};
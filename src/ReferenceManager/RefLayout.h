@@ -0,0 +1,113 @@
+//
+// Copyright 2009 Autodesk, Inc.  All rights reserved.
+//
+// Use of this software is subject to the terms of the Autodesk license
+// agreement provided at the time of installation or download, or which
+// otherwise accompanies this software in either electronic or hard copy form.
+//
+
+#pragma once
+
+// Visual Studio 2012 (v110) and older have no variadic templates.  There,
+// RefIdList takes at most 16 ids, with unused trailing ids left at -1.
+#if defined(_MSC_VER) && _MSC_VER < 1800 && !defined(REFMGR_NO_VARIADIC_TEMPLATES)
+#define REFMGR_NO_VARIADIC_TEMPLATES
+#endif
+
+//=========================================================
+/// A compile-time list of reference ids, see RefLayout
+#ifndef REFMGR_NO_VARIADIC_TEMPLATES
+template<int... IDS> struct RefIdList;
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+template<> struct RefIdList<>
+{
+	static const int kCount = 0;
+	static const unsigned long long kMask = 0;
+};
+
+template<int ID, int... IDS> struct RefIdList<ID, IDS...>
+{
+	static_assert(ID >= 0 && ID < 64, "Reference layout ids must be in the range [0, 64)");
+	static_assert((RefIdList<IDS...>::kMask & (1ULL << ID)) == 0, "Duplicate id in reference layout");
+
+	static const int kCount = 1 + RefIdList<IDS...>::kCount;
+	static const unsigned long long kMask = (1ULL << ID) | RefIdList<IDS...>::kMask;
+};
+#endif
+
+#else
+
+template<int ID0 = -1, int ID1 = -1, int ID2 = -1, int ID3 = -1, int ID4 = -1, int ID5 = -1, int ID6 = -1, int ID7 = -1, int ID8 = -1, int ID9 = -1, int ID10 = -1, int ID11 = -1, int ID12 = -1, int ID13 = -1, int ID14 = -1, int ID15 = -1>
+struct RefIdList
+{
+	typedef RefIdList<ID1, ID2, ID3, ID4, ID5, ID6, ID7, ID8, ID9, ID10, ID11, ID12, ID13, ID14, ID15> Rest;
+
+	static_assert(ID0 >= 0 && ID0 < 64, "Reference layout ids must be in the range [0, 64)");
+	static_assert((Rest::kMask & (1ULL << ID0)) == 0, "Duplicate id in reference layout");
+
+	static const int kCount = 1 + Rest::kCount;
+	static const unsigned long long kMask = (1ULL << ID0) | Rest::kMask;
+};
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+template<> struct RefIdList<-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1>
+{
+	static const int kCount = 0;
+	static const unsigned long long kMask = 0;
+};
+#endif
+
+#endif // REFMGR_NO_VARIADIC_TEMPLATES
+
+//=========================================================
+/// Declares the references of a ReferenceManager up front.
+///
+/// By default, ReferenceManager discovers its references as the
+/// RefPtrs and RefArrays register themselves, and resolves the
+/// index of each at run time.  A class whose references are known
+/// at compile time may instead declare them, by passing a RefLayout
+/// as the third template parameter of ReferenceManager.  The slots of
+/// the declared RefPtrs are then reserved, and the declared RefArrays
+/// registered, when the manager is constructed.  So registering the
+/// references never shifts the ones already registered, and only
+/// RefArrays use the dynamic index bookkeeping.
+///
+/// \code
+/// enum RefID {
+///		CTRL_REF,
+///		INODE_REF,
+///		INODE_TAB_REF,
+/// };
+/// typedef RefLayout< RefIdList<CTRL_REF, INODE_REF>, RefIdList<INODE_TAB_REF> > MyRefLayout;
+///
+/// class MyReferenceMaker : public ReferenceManager<ReferenceMaker, 0, MyRefLayout> {
+///		RefPtr<Control, CTRL_REF> m_pCtrl;
+///		RefPtr<INode, INODE_REF> m_pINode;
+///		RefArray<INode, INODE_TAB_REF> m_pINodeTab;
+///		...
+/// \endcode
+/// \param STATIC_IDS A RefIdList of the BASE_IDs of every RefPtr.  These must be 0 to N-1.
+/// \param ARRAY_IDS A RefIdList of the BASE_IDs of every RefArray.  These must
+///					immediately follow the static ids.
+template<typename STATIC_IDS = RefIdList<>, typename ARRAY_IDS = RefIdList<> >
+struct RefLayout
+{
+	static const int kNumStaticRefs = STATIC_IDS::kCount;
+	static const int kNumArrays = ARRAY_IDS::kCount;
+
+	static_assert(kNumStaticRefs + kNumArrays < 64, "Reference layouts are limited to 63 ids");
+	static_assert(STATIC_IDS::kMask == (1ULL << kNumStaticRefs) - 1,
+		"Static reference ids in a layout must be 0 to N-1");
+	static_assert(ARRAY_IDS::kMask == (((1ULL << kNumArrays) - 1) << kNumStaticRefs),
+		"RefArray ids in a layout must immediately follow the static reference ids");
+
+	/// Returns true if id is a static reference in this layout
+	static bool IsStatic(size_t id) { return id < size_t(kNumStaticRefs); }
+
+	/// Returns true if id is a RefArray in this layout
+	static bool IsArray(size_t id) { return id >= size_t(kNumStaticRefs) && id < size_t(kNumStaticRefs + kNumArrays); }
+};
+
+/// The default layout, where all references are discovered at run time
+typedef RefLayout<> DynamicRefLayout;
@@ -0,0 +1,215 @@
+//
+// Copyright 2009 Autodesk, Inc.  All rights reserved.
+//
+// Use of this software is subject to the terms of the Autodesk license
+// agreement provided at the time of installation or download, or which
+// otherwise accompanies this software in either electronic or hard copy form.
+//
+
+#pragma once
+
+// ReferenceManager instrumentation.  This is compiled out unless
+// REFMGR_ENABLE_STATS is defined (for every file including ReferenceManager.h).
+// When enabled, each ReferenceManager counts its work, and the counts of
+// every instance are also aggregated into RefMgrGlobalStats.
+// The counters of each instance are not atomic - like the rest of the
+// ReferenceManager, they should only be updated from the main thread.
+// The global counters are shared by every instance, so they are atomic.
+
+#ifdef REFMGR_ENABLE_STATS
+
+#if defined(_MSC_VER) && _MSC_VER <= 1600
+#error "REFMGR_ENABLE_STATS needs <atomic> and <chrono> (Visual Studio 2012 or later)"
+#endif
+
+#include "IReferenceManager.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <string>
+
+/// The counters kept by each ReferenceManager when REFMGR_ENABLE_STATS is defined
+struct RefMgrStats
+{
+	typedef unsigned long long Counter;
+
+	Counter numIndexLookups;			// Calls to GetReference
+	Counter numTargetLookups;			// Calls to GetReferenceIndex(ReferenceTarget*)
+	Counter numLinearScans;				// Lookups that had to scan the references
+	Counter linearScanLength;			// The total number of references scanned by them
+	Counter numNotifies;				// Calls to NotifyRefChanged
+	Counter notifyNanoseconds;			// Total time spent in NotifyRefChanged.  Nested calls are not counted again.
+	Counter numInfoAllocs;				// RefInfo records allocated
+	Counter numInfoFrees;				// RefInfo records freed
+	Counter numCallbacks[kNumRefMsgTypes];	// Messages passed to a reference callback, by RefMessageType
+	Counter numFiltered[kNumRefMsgTypes];	// Messages a callbacks message filter skipped, by RefMessageType
+
+	RefMgrStats() { Reset(); }
+
+	void Reset() { memset(this, 0, sizeof(*this)); }
+
+	/// Returns the name ToJson uses for a RefMessageType
+	static const char* GetMsgTypeName(int msgType)
+	{
+		static const char* kMsgTypeNames[kNumRefMsgTypes] = {
+			"change", "targetDeleted", "subAnimStructureChanged", "nodeNameChange", "edit", "user", "other"
+		};
+		return (msgType >= 0 && msgType < kNumRefMsgTypes) ? kMsgTypeNames[msgType] : "";
+	}
+
+	/// Writes the counters as a JSON object
+	std::string ToJson() const
+	{
+		std::ostringstream json;
+		json << "{"
+			<< "\"numIndexLookups\":" << numIndexLookups
+			<< ",\"numTargetLookups\":" << numTargetLookups
+			<< ",\"numLinearScans\":" << numLinearScans
+			<< ",\"linearScanLength\":" << linearScanLength
+			<< ",\"numNotifies\":" << numNotifies
+			<< ",\"notifyNanoseconds\":" << notifyNanoseconds
+			<< ",\"numInfoAllocs\":" << numInfoAllocs
+			<< ",\"numInfoFrees\":" << numInfoFrees;
+		WriteByMsgType(json, "numCallbacks", numCallbacks);
+		WriteByMsgType(json, "numFiltered", numFiltered);
+		json << "}";
+		return json.str();
+	}
+
+private:
+	// Writes ,"name":{"change":n,...}
+	static void WriteByMsgType(std::ostringstream& json, const char* name, const Counter* counters)
+	{
+		json << ",\"" << name << "\":{";
+		for (int i = 0; i < kNumRefMsgTypes; i++)
+			json << (i > 0 ? "," : "") << "\"" << GetMsgTypeName(i) << "\":" << counters[i];
+		json << "}";
+	}
+};
+
+/// The counters of every ReferenceManager, added together
+struct RefMgrGlobalStats
+{
+	typedef std::atomic<RefMgrStats::Counter> Counter;
+
+	Counter numIndexLookups;
+	Counter numTargetLookups;
+	Counter numLinearScans;
+	Counter linearScanLength;
+	Counter numNotifies;
+	Counter notifyNanoseconds;
+	Counter numInfoAllocs;
+	Counter numInfoFrees;
+	Counter numCallbacks[kNumRefMsgTypes];
+	Counter numFiltered[kNumRefMsgTypes];
+
+	static RefMgrGlobalStats& Get()
+	{
+		static RefMgrGlobalStats s_global;
+		return s_global;
+	}
+
+	/// Returns a copy of the counters.  Counters updated meanwhile by
+	/// other threads may or may not be included.
+	RefMgrStats Load() const
+	{
+		RefMgrStats stats;
+		stats.numIndexLookups = numIndexLookups.load(std::memory_order_relaxed);
+		stats.numTargetLookups = numTargetLookups.load(std::memory_order_relaxed);
+		stats.numLinearScans = numLinearScans.load(std::memory_order_relaxed);
+		stats.linearScanLength = linearScanLength.load(std::memory_order_relaxed);
+		stats.numNotifies = numNotifies.load(std::memory_order_relaxed);
+		stats.notifyNanoseconds = notifyNanoseconds.load(std::memory_order_relaxed);
+		stats.numInfoAllocs = numInfoAllocs.load(std::memory_order_relaxed);
+		stats.numInfoFrees = numInfoFrees.load(std::memory_order_relaxed);
+		for (int i = 0; i < kNumRefMsgTypes; i++)
+		{
+			stats.numCallbacks[i] = numCallbacks[i].load(std::memory_order_relaxed);
+			stats.numFiltered[i] = numFiltered[i].load(std::memory_order_relaxed);
+		}
+		return stats;
+	}
+
+	void Reset()
+	{
+		numIndexLookups = 0;
+		numTargetLookups = 0;
+		numLinearScans = 0;
+		linearScanLength = 0;
+		numNotifies = 0;
+		notifyNanoseconds = 0;
+		numInfoAllocs = 0;
+		numInfoFrees = 0;
+		for (int i = 0; i < kNumRefMsgTypes; i++)
+		{
+			numCallbacks[i] = 0;
+			numFiltered[i] = 0;
+		}
+	}
+
+private:
+	RefMgrGlobalStats() { Reset(); }
+	RefMgrGlobalStats(const RefMgrGlobalStats&);
+	RefMgrGlobalStats& operator=(const RefMgrGlobalStats&);
+};
+
+// Increment a counter on both the instance and the global stats
+#define REFMGR_STAT_ADD(counter, n) \
+	do { m_stats.counter += (n); RefMgrGlobalStats::Get().counter.fetch_add((n), std::memory_order_relaxed); } while (0)
+
+// thread_local needs Visual Studio 2015
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define REFMGR_THREAD_LOCAL __declspec(thread)
+#else
+#define REFMGR_THREAD_LOCAL thread_local
+#endif
+
+// Time the rest of the current scope into notifyNanoseconds.
+// NotifyRefChanged nests whenever a callback changes another target, so
+// only the outermost call is timed: on the instance, the outermost call
+// on that instance, and globally, the outermost call on this thread.
+class RefMgrStatTimer
+{
+	RefMgrStats& m_stats;
+	int& m_depth;	// The number of timed calls running on the instance
+	std::chrono::high_resolution_clock::time_point m_start;
+	RefMgrStatTimer& operator=(const RefMgrStatTimer&);
+
+	static int& GlobalDepth()
+	{
+		static REFMGR_THREAD_LOCAL int s_depth = 0;
+		return s_depth;
+	}
+
+public:
+	RefMgrStatTimer(RefMgrStats& stats, int& depth)
+		: m_stats(stats), m_depth(depth)
+	{
+		if (m_depth++ == 0 || GlobalDepth() == 0)
+			m_start = std::chrono::high_resolution_clock::now();
+		GlobalDepth()++;
+	}
+	~RefMgrStatTimer()
+	{
+		bool isOutermost = (--m_depth == 0);
+		bool isGlobalOutermost = (--GlobalDepth() == 0);
+		if (!isOutermost && !isGlobalOutermost)
+			return;
+
+		RefMgrStats::Counter ns = RefMgrStats::Counter(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::high_resolution_clock::now() - m_start).count());
+		if (isOutermost)
+			m_stats.notifyNanoseconds += ns;
+		if (isGlobalOutermost)
+			RefMgrGlobalStats::Get().notifyNanoseconds.fetch_add(ns, std::memory_order_relaxed);
+	}
+};
+#define REFMGR_STAT_TIME_NOTIFY() RefMgrStatTimer refMgrStatTimer(m_stats, m_statNotifyDepth)
+
+#else
+
+#define REFMGR_STAT_ADD(counter, n) ((void)0)
+#define REFMGR_STAT_TIME_NOTIFY() ((void)0)
+
+#endif // REFMGR_ENABLE_STATS
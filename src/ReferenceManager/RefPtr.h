@@ -9,6 +9,12 @@
 #pragma once
 
 #include "ReferenceManager.h"
+#include "RefArrayView.h"
+#include <algorithm>
+#include <iterator>
+#include <type_traits>
+
+template<typename REF_TYPE_T, int BASE_ID> class RefArray;
 
 //=========================================================
 /// \brief This class provides an easy interface for defining and accessing the references stored on an IReferenceManager.
@@ -65,11 +71,42 @@ protected:
 	IReferenceManager* m_pMgr;			// The manager who holds our reference
 	IReferenceManager::RefInfo* m_ref;	// We hold the pointer directly to Managers RefInfo
 										// This allows the underlying RefIDX to change
+	ReferenceTarget* m_target;			// A copy of m_ref->m_target, kept current by the manager
+										// (see RefInfo::m_pTargetCache).  Reading our target is one load.
+
+	// Ask the manager to keep m_target current.  This must be called again 
+	// whenever we are moved in memory (see RefArray::RebindCaches)
+	void BindCache()
+	{
+		m_target = m_ref->m_target;
+		m_ref->m_pTargetCache = &m_target;
+	}
 
 	// !No default construction!
 	RefPtr();
 	RefPtr(const RefPtr& rhs);
 	//REF_TYPE_T* operator=(RefPtr& rhs);
+
+	// RefArray registers its references in bulk, and then 
+	// constructs RefPtrs around the already registered RefInfos
+	friend class RefArray<REF_TYPE_T, BASE_ID>;
+	RefPtr(IReferenceManager::RefInfo* pInfo, IReferenceManager& mgr)
+		:	m_pMgr(&mgr)
+		,	m_ref(pInfo)
+	{
+		DbgAssert(m_ref != NULL);
+		BindCache();
+	}
+
+	// Allows WeakRefPtr to register a weak reference
+	RefPtr(IReferenceManager& mgr, NotifyCallback* callback, int index, REF_TYPE_T* pTarget, DWORD messageFilter, bool isWeak)
+		:	m_pMgr(&mgr)
+		,	m_ref(mgr.RegisterReference(BASE_ID, index, callback, pTarget, isWeak, true, messageFilter))
+	{
+		DbgAssert(m_ref != NULL);
+		DbgAssert(m_ref->m_target == pTarget);
+		BindCache();
+	}
 public:
 
 	/**  Construct a RefPtr, registering the reference with the owning manager.
@@ -81,18 +118,23 @@ public:
 					parameter in that array.  Normally, developers shouldn't create arrays
 					of RefPtr, they should use the RefArray class to manage dynamic 
 					arrays of references.
-	\param pTarget - An initial reference to target. */
-	RefPtr(IReferenceManager& mgr, NotifyCallback* callback=NULL, int index=0, REF_TYPE_T* pTarget = NULL)
+	\param pTarget - An initial reference to target. 
+	\param messageFilter - The RefMessageFilter of messages callback should receive. */
+	RefPtr(IReferenceManager& mgr, NotifyCallback* callback=NULL, int index=0, REF_TYPE_T* pTarget = NULL, DWORD messageFilter = kRefMsgFilterAll)
 		:	m_pMgr(&mgr)
-		,	m_ref(mgr.RegisterReference(BASE_ID, index, callback, pTarget))
+		,	m_ref(mgr.RegisterReference(BASE_ID, index, callback, pTarget, false, true, messageFilter))
 	{
 		// Double check stuff
 		DbgAssert(m_ref != NULL);
 		DbgAssert(m_ref->m_target == pTarget);
+		BindCache();
 	}
 
 	/** Release the Reference, release the backing ReferenceManager structure. */
 	virtual ~RefPtr() {
+		// RefArray may have already released us in bulk
+		if (m_ref == NULL)
+			return;
 		// These actions are not undoable
 		HoldSuspend hs;
 		// This actually resizes the backing RefItem
@@ -108,6 +150,21 @@ public:
 	\return The pointer referenced */
 	const REF_TYPE_T* GetRef() const { return *this; }
 
+private:
+	// Set the reference to an already type-checked value
+	REF_TYPE_T* Assign(REF_TYPE_T* pType) {
+		// Set the reference.  Our RefInfo always knows its current index.
+		int n = m_ref->m_slot;
+		DbgAssert(n >= 0 && n == m_pMgr->GetReferenceIndex(m_ref));
+		if (n >= 0)
+			m_pMgr->SetRef(n, pType);
+		// double check that we have been assigned correctly.
+		DbgAssert(pType == m_ref->m_target);
+		// Return our type'd pointer
+		return pType;
+	}
+
+public:
 	//----------------------------------------------------
 #pragma  region // operator overloads
 
@@ -122,15 +179,20 @@ public:
 		REF_TYPE_T* pType = dynamic_cast<REF_TYPE_T*>(rhs); 
 		// Check that our incoming value is appropriate
 		DbgAssert(pType == rhs);
-		// Set the reference
-		int n = m_pMgr->GetReferenceIndex(m_ref);
-		DbgAssert(n >= 0);
-		if (n >= 0)
-			m_pMgr->SetRef(n, pType);
-		// double check that we have been assigned correctly.
-		DbgAssert(pType == m_ref->m_target);
-		// Return our type'd pointer
-		return pType;
+		return Assign(pType);
+	}
+
+	/** Assign a new reference from a pointer already known to be a REF_TYPE_T.
+	Any pointer implicitly convertible to REF_TYPE_T* (ie a REF_TYPE_T, or a class 
+	derived from it) is checked at compile time, so no run-time cast is needed.  
+	Pointers to any other class (eg an untyped ReferenceTarget*) use the checked 
+	operator=(ReferenceTarget*) instead.
+	\param rhs The new value of the of the reference
+	\return The new value of the reference. */
+	template<typename U>
+	typename std::enable_if<std::is_convertible<U*, REF_TYPE_T*>::value, const REF_TYPE_T*>::type
+	operator=(U* rhs) {
+		return Assign(rhs);
 	}
 
 	/** Assign a new reference.  
@@ -171,7 +233,8 @@ public:
 		// We know this static_cast is safe, because our assignment
 		// operator will validate any value going in (so
 		// we do not allow any other types to be set)
-		return static_cast<REF_TYPE_T*>(m_ref->m_target);
+		DbgAssert(m_target == m_ref->m_target && "ERROR: RefPtr target cache is stale");
+		return static_cast<REF_TYPE_T*>(m_target);
 	}
 	/** Allow direct cast to type
 	This function allows us to auto-cast to const REF_TYPE_T and use as below
@@ -179,7 +242,8 @@ public:
 	const REF_TYPE_T* x = RefPtr<REF_TYPE_T> m;
 	\endcode */
 	operator const REF_TYPE_T*() const {
-		return static_cast<const REF_TYPE_T*>(m_ref->m_target);
+		DbgAssert(m_target == m_ref->m_target && "ERROR: RefPtr target cache is stale");
+		return static_cast<const REF_TYPE_T*>(m_target);
 	}
 #pragma endregion // operator overloads
 };
@@ -189,11 +253,9 @@ template<typename REF_TYPE_T, int BASE_ID>
 class WeakRefPtr : public RefPtr<REF_TYPE_T, BASE_ID>
 {
 public:
-	WeakRefPtr(IReferenceManager& mgr, NotifyCallback* callback=NULL, int index=0, REF_TYPE_T* pTarget = NULL)
-		:	RefPtr(mgr, callback, index, pTarget)
+	WeakRefPtr(IReferenceManager& mgr, NotifyCallback* callback=NULL, int index=0, REF_TYPE_T* pTarget = NULL, DWORD messageFilter = kRefMsgFilterAll)
+		:	RefPtr<REF_TYPE_T, BASE_ID>(mgr, callback, index, pTarget, messageFilter, true)
 	{
-		// Assume m_ref has been created successfully
-		m_ref->SetIsWeak(true);
 	}
 
 	/** Assign a new reference.  
@@ -202,7 +264,7 @@ public:
 	\return The new value of the reference.  */
 	const REF_TYPE_T* operator=(REF_TYPE_T* rhs) {
 		// make the assignment via the equals operator overload (cast to ReferenceTarget
-		return RefPtr::operator=(rhs);
+		return RefPtr<REF_TYPE_T, BASE_ID>::operator=(rhs);
 	}
 };
 
@@ -212,6 +274,8 @@ public:
 /// \n Note: When using this class, due to the underlying implementation
 /// it is mildly more memory efficient (but not mandatory) to define
 /// any RefArrays with a higher index than the static RefPtrs.
+/// \n Note: Only modify a RefArray through its own functions, never through a
+/// Tab reference or pointer to it.  The Tab functions do not keep the manager in step.
 /// A sample implementation of a ReferenceMaker with a single RefPtr and a run-time sized 
 /// RefArray of INode references is below
 /// \code
@@ -256,21 +320,213 @@ public:
 template<typename REF_TYPE_T, int BASE_ID>
 class RefArray : public Tab < RefPtr <REF_TYPE_T, BASE_ID> > {
 private:
+	typedef Tab< RefPtr<REF_TYPE_T, BASE_ID> > BaseTab;
+
 	IReferenceManager* m_pMgr;
 	NotifyCallback* m_callback;
+	DWORD m_messageFilter;
+	// If set, every reference in the array calls this one callback
+	ArrayNotifyCallback m_sharedCallback;
+	// Changes whenever references are inserted or deleted, or the array is
+	// reordered, so PermuteRestore can tell if its range still holds what
+	// it left there.  Generations are never reused, m_lastGeneration is
+	// the most recent one handed out.
+	DWORD m_generation;
+	DWORD m_lastGeneration;
 
 	// No default construction
 	RefArray();
 	RefArray(const RefArray&);
 
 	// None of this either
-	Tab& operator=(const Tab& tb);
+	BaseTab& operator=(const BaseTab& tb);
+
+	// Each RefInfo points at its RefPtrs m_target (RefInfo::m_pTargetCache), so
+	// our RefPtrs may only be moved by functions that rebind them afterwards.
+	// These Tab functions would move or drop them behind the managers back.
+	using BaseTab::Addr;
+	using BaseTab::ZeroCount;
+	using BaseTab::Init;
+	void Sort(CompareFnc cmp);	// qsort.  Use the Sort below, which keeps the manager in step
+
+	// Undo/Redo for Swap, Move and Sort.  Stores the permutation, and the
+	// generations of the array before and after it.  Insert, Delete etc are
+	// not undoable, so if they have changed the array since, the undo is
+	// skipped rather than reordering the wrong references.  The array is
+	// only touched while its owner is alive (its AnimHandle is never reused),
+	// so a restore outliving its owner is skipped too.
+	class PermuteRestore : public RestoreObj {
+	private:
+		RefArray* m_pArray;
+		Animatable* m_pOwner;
+		AnimHandle m_ownerHandle;
+		int m_index;
+		std::vector<int> m_order;
+		DWORD m_genBefore;
+		DWORD m_genAfter;
+
+		// Returns our array if it is in the state expected, or NULL
+		RefArray* GetArray(DWORD generation)
+		{
+			if (m_pOwner != NULL && Animatable::GetAnimByHandle(m_ownerHandle) != m_pOwner)
+				return NULL;
+			bool matches = m_pArray->m_generation == generation;
+			DbgAssert(matches && "ERROR: RefArray was resized since it was reordered, the reorder cannot be undone");
+			return matches ? m_pArray : NULL;
+		}
+	public:
+		PermuteRestore(RefArray* pArray, int index, const std::vector<int>& order, DWORD genBefore)
+			: m_pArray(pArray), m_pOwner(dynamic_cast<Animatable*>(pArray->m_pMgr)), m_ownerHandle(0)
+			, m_index(index), m_order(order), m_genBefore(genBefore), m_genAfter(pArray->m_generation)
+		{
+			if (m_pOwner != NULL)
+				m_ownerHandle = Animatable::GetHandleByAnim(m_pOwner);
+		}
+
+		virtual void Restore(int isUndo)
+		{
+			UNUSED_PARAM(isUndo);
+			RefArray* pArray = GetArray(m_genAfter);
+			if (pArray == NULL)
+				return;
+			std::vector<int> inverse(m_order.size());
+			for (size_t i = 0; i < m_order.size(); i++)
+				inverse[m_order[i]] = int(i);
+			if (pArray->ApplyPermutation(m_index, inverse))
+				pArray->m_generation = m_genBefore;
+		}
+		virtual void Redo()
+		{
+			RefArray* pArray = GetArray(m_genBefore);
+			if (pArray != NULL && pArray->ApplyPermutation(m_index, m_order))
+				pArray->m_generation = m_genAfter;
+		}
+		virtual int Size() { return int(sizeof(*this) + m_order.size() * sizeof(int)); }
+		virtual TSTR Description() { return _T("RefArray reorder"); }
+	};
+
+	// Start a new generation, after references have been inserted, deleted or reordered
+	void NewGeneration()
+	{
+		m_generation = ++m_lastGeneration;
+	}
+
+	// Reorder [index, index + order.size()) so the item at index + i is the one
+	// that was at index + order[i].  Both our RefPtrs and the managers slots are
+	// permuted, no references are released or re-registered.
+	bool ApplyPermutation(int index, const std::vector<int>& order)
+	{
+		int count = (int)order.size();
+		DbgAssert(index >= 0 && index + count <= Count() && "ERROR: Reordering past the end of the array");
+		if (index < 0 || index + count > Count())
+			return false;
+
+		if (!m_pMgr->PermuteReferences(BASE_ID, index, count, &order[0]))
+			return false;
+
+		// Our RefPtrs only differ by their RefInfo
+		std::vector<IReferenceManager::RefInfo*> refs(count);
+		for (int i = 0; i < count; i++)
+			refs[i] = (*this)[index + i].m_ref;
+		for (int i = 0; i < count; i++)
+		{
+			(*this)[index + i].m_ref = refs[order[i]];
+			(*this)[index + i].BindCache();
+		}
+		return true;
+	}
+
+	// Our RefPtrs from 'start' up have moved in memory (or all of them, if the
+	// Tab has been reallocated away from pOldData).  Point their RefInfos at
+	// the new location of their target caches.
+	void RebindCaches(int start, const void* pOldData)
+	{
+		if (Count() == 0)
+			return;
+		if (Addr(0) != pOldData)
+			start = 0;
+		for (int i = start; i < Count(); i++)
+			(*this)[i].BindCache();
+	}
+
+	// Set reference i to pTarget, unless it already holds it
+	void AssignAt(int i, REF_TYPE_T* pTarget)
+	{
+		IReferenceManager::RefInfo* pInfo = (*this)[i].m_ref;
+		if (pInfo->m_target != pTarget)
+			m_pMgr->SetRef(pInfo->m_slot, pTarget);
+	}
+
+	// Assign for forward iterators: the range can be measured first, so the
+	// array is resized in one batch
+	template<typename ITER_T>
+	void AssignRange(ITER_T first, ITER_T last, std::forward_iterator_tag)
+	{
+		int n = (int)std::distance(first, last);
+		DbgAssert(n >= 0);
+		SetCount(n);
+
+		for (int i = 0; i < n; ++i, ++first)
+			AssignAt(i, *first);
+	}
+
+	// Assign for input iterators, which can only be read once: reuse the
+	// existing references, append any more one at a time, then drop the rest
+	template<typename ITER_T>
+	void AssignRange(ITER_T first, ITER_T last, std::input_iterator_tag)
+	{
+		int i = 0;
+		for (; first != last; ++first, ++i)
+		{
+			REF_TYPE_T* pTarget = *first;
+			if (i < Count())
+				AssignAt(i, pTarget);
+			else
+				Append(pTarget);
+		}
+		SetCount(i);
+	}
+
+	// Reorder, and record the permutation for undo
+	void Permute(int index, const std::vector<int>& order)
+	{
+		if (order.size() <= 1)
+			return;
+		DWORD genBefore = m_generation;
+		if (!ApplyPermutation(index, order))
+			return;
+		NewGeneration();
+		if (theHold.Holding())
+			theHold.Put(new PermuteRestore(this, index, order, genBefore));
+	}
 public:
+	using BaseTab::Count;
 
 	/** Contructs the Array, and ensures it is valid.
-	\param mgr The owner of this array */
-	RefArray(IReferenceManager& mgr, NotifyCallback* callback=NULL)
-		: m_pMgr(&mgr), m_callback(callback)
+	\param mgr The owner of this array 
+	\param callback If not NULL, each reference in the array will call a copy of this callback
+	\param messageFilter The RefMessageFilter of messages the callback should receive. */
+	RefArray(IReferenceManager& mgr, NotifyCallback* callback=NULL, DWORD messageFilter = kRefMsgFilterAll)
+		: m_pMgr(&mgr), m_callback(callback), m_messageFilter(messageFilter)
+		, m_generation(0), m_lastGeneration(0)
+	{
+		m_pMgr->RegisterReferenceArray(BASE_ID);
+	}
+
+	/** Contructs the Array, with one callback shared by all its references.
+	Unlike a NotifyCallback, no per-reference copies are made, and the callback
+	is also passed the index in this array of the reference being notified.
+	\code
+	RefResult MyClass::OnNodeMsg(int index, RefMessage msg, PartID& partID);
+	...
+	m_nodes(GetRefMgr(), MakeArrayNotifyCallback(this, &MyClass::OnNodeMsg))
+	\endcode
+	\param mgr The owner of this array 
+	\param callback The callback for every reference in the array.
+	\param messageFilter The RefMessageFilter of messages the callback should receive. */
+	RefArray(IReferenceManager& mgr, const ArrayNotifyCallback& callback, DWORD messageFilter = kRefMsgFilterAll)
+		: m_pMgr(&mgr), m_callback(NULL), m_messageFilter(messageFilter), m_sharedCallback(callback)
+		, m_generation(0), m_lastGeneration(0)
 	{
 		m_pMgr->RegisterReferenceArray(BASE_ID);
 	}
@@ -290,46 +546,65 @@ public:
 	}
 
 	/** Append 'n' new references from the pTarget array
-	Re-implements the Tab function. See Tab::Append for more docs */
+	Re-implements the Tab function. See Tab::Append for more docs 
+	If pTarget is NULL, the new references are all NULL */
 	void Append(int n, REF_TYPE_T** pTarget) 
 	{
-		int arrayOldSize = Count();
-		// Allocate (unconstructed) array
-		Tab::SetCount(arrayOldSize + n);
-		for (int i = 0; i < n; i++)
-		{
-			// Call our constructor! (pMgr, idx, target)
-			new(Addr(arrayOldSize + i)) RefPtr<REF_TYPE_T, BASE_ID>(*m_pMgr, new NotifyCallback(m_callback), arrayOldSize + i, pTarget[i]);
-		}
-		// Update the _used_ part of our array
-		
+		Insert(Count(), n, pTarget);
 	}
 
 	/** Insert 'count' new references from the pTarget array at 'index'
-	Re-implements the Tab function. See Tab::Insert for more docs */
+	Re-implements the Tab function. See Tab::Insert for more docs 
+	If pTarget is NULL, the new references are all NULL.
+	All the new references are registered with the manager in one batch,
+	so inserting n references is O(n), not O(n * NumRefs()) */
 	void Insert(int index, int count, REF_TYPE_T** pTarget) 
 	{
+		if (count <= 0)
+			return;
+
 		int arrayOldSize = Count();
+		DbgAssert(index >= 0 && index <= arrayOldSize);
+		if (index < 0 || index > arrayOldSize)
+			index = arrayOldSize;
+
+		// Register all the new references at once
+		std::vector<IReferenceManager::RefInfo*> newInfos(count);
+		const ArrayNotifyCallback* pShared = m_sharedCallback ? &m_sharedCallback : NULL;
+		if (!m_pMgr->RegisterReferences(BASE_ID, index, count, m_callback, &newInfos[0], false, true, m_messageFilter, pShared))
+			return;
+		NewGeneration();
+
 		// Allocate (unconstructed) array
-		Tab::Resize(arrayOldSize + count);
-		// Move the existing items
-		memmove(Addr(index), Addr(index + count), count * sizeof(RefPtr<REF_TYPE_T, BASE_ID>));
+		const void* pOldData = (arrayOldSize > 0) ? Addr(0) : NULL;
+		BaseTab::SetCount(arrayOldSize + count);
+		// Move the existing items up out of the way
+		if (index < arrayOldSize)
+			memmove(Addr(index + count), Addr(index), (arrayOldSize - index) * sizeof(RefPtr<REF_TYPE_T, BASE_ID>));
 		// Call the constructor for new items!
 		for (int i = 0; i < count; i++)
-			new(Addr(arrayOldSize + i)) RefPtr<REF_TYPE_T, BASE_ID>(*m_pMgr, new NotifyCallback(m_callback), arrayOldSize + i, pTarget[i]);
-		// Update the _used_ part of our array
-		Tab::SetCount(arrayOldSize + count);
+			new(Addr(index + i)) RefPtr<REF_TYPE_T, BASE_ID>(newInfos[i], *m_pMgr);
+		RebindCaches(index + count, pOldData);
+
+		// Finally, assign the initial values
+		if (pTarget != NULL)
+		{
+			for (int i = 0; i < count; i++)
+			{
+				if (pTarget[i] != NULL)
+					(*this)[index + i] = pTarget[i];
+			}
+		}
 	}
 
 	/** Sets the size of the array to 'n'
 	Re-implements the Tab function. See Tab::SetCount for more docs */
 	void SetCount(int n) 
 	{
-		REF_TYPE_T* pNull = NULL;
 		// Grow
-		while (Count() < n)
+		if (Count() < n)
 		{
-			Append(1, &pNull);
+			Append(n - Count(), NULL);
 		}
 		// Shrink
 		if (n < Count())
@@ -344,6 +619,14 @@ public:
 		SetCount(n);
 	}
 
+	/** Frees any unused capacity.
+	Re-implements the Tab function. See Tab::Shrink for more docs */
+	void Shrink() {
+		const void* pOldData = (Count() > 0) ? Addr(0) : NULL;
+		BaseTab::Shrink();
+		RebindCaches(0, pOldData);
+	}
+
 	/** Deletes 'num' references, starting at 'start'
 	See Tab::Delete for more docs */
 	int Delete(int start, int num) { 
@@ -355,10 +638,19 @@ public:
 		if (numToDelete <= 0)
 			return oldCount;
 
-		// Destruct entities
+		// Release all the references in one batch
 		int maxIdx = start + numToDelete;
+		{
+			// These actions are not undoable
+			HoldSuspend hs;
+			m_pMgr->ReleaseReferences((*this)[start].m_ref, numToDelete, BASE_ID);
+		}
+		NewGeneration();
+
+		// Destruct entities.  Their references are already gone.
 		for (int i = maxIdx-1; i >= start; --i)
 		{
+			(*this)[i].m_ref = NULL;
 			(*this)[i].~RefPtr<REF_TYPE_T, BASE_ID>();
 		}
 
@@ -366,12 +658,142 @@ public:
 		int newCount = oldCount - numToDelete;
 		
 		if (maxIdx < oldCount)
-			memmove(Addr(start), Addr(maxIdx), numToDelete * sizeof(RefPtr<REF_TYPE_T, BASE_ID>));
+			memmove(Addr(start), Addr(maxIdx), (oldCount - maxIdx) * sizeof(RefPtr<REF_TYPE_T, BASE_ID>));
 
-		Tab::SetCount(newCount);
+		const void* pOldData = Addr(0);
+		BaseTab::SetCount(newCount);
+		RebindCaches(start, pOldData);
 		return newCount;
 	}
 
+	/** Deletes every reference i for which toDelete[i] is true.
+	The references are released in one batch, and the remaining
+	references are moved down in a single pass, so this is O(Count())
+	however many references are deleted.
+	\return The new number of references in the array */
+	int Delete(const std::vector<bool>& toDelete) {
+		int oldCount = Count();
+		int numFlags = min(oldCount, (int)toDelete.size());
+
+		std::vector<IReferenceManager::RefInfo*> infos;
+		for (int i = 0; i < numFlags; i++)
+		{
+			if (toDelete[i])
+				infos.push_back((*this)[i].m_ref);
+		}
+		if (infos.empty())
+			return oldCount;
+
+		// Release all the references in one batch
+		{
+			// These actions are not undoable
+			HoldSuspend hs;
+			m_pMgr->ReleaseReferences(&infos[0], (int)infos.size(), BASE_ID);
+		}
+		NewGeneration();
+
+		// Destruct the deleted entities, and move the rest down over them
+		int newCount = 0;
+		for (int i = 0; i < oldCount; i++)
+		{
+			if (i < numFlags && toDelete[i])
+			{
+				(*this)[i].m_ref = NULL;
+				(*this)[i].~RefPtr<REF_TYPE_T, BASE_ID>();
+			}
+			else
+			{
+				if (newCount != i)
+					memcpy(Addr(newCount), Addr(i), sizeof(RefPtr<REF_TYPE_T, BASE_ID>));
+				newCount++;
+			}
+		}
+
+		const void* pOldData = Addr(0);
+		BaseTab::SetCount(newCount);
+		RebindCaches(0, pOldData);
+		return newCount;
+	}
+
+	/** Exchange the references at i and j.
+	The references are not released or re-registered, so their targets are not notified. 
+	This is undoable.  If the references are sub-anims, the owner may 
+	need to send REFMSG_SUBANIM_STRUCTURE_CHANGED */
+	void Swap(int i, int j) {
+		if (i == j)
+			return;
+		int lo = min(i, j);
+		int count = max(i, j) - lo + 1;
+		std::vector<int> order(count);
+		for (int k = 0; k < count; k++)
+			order[k] = k;
+		std::swap(order[0], order[count - 1]);
+		Permute(lo, order);
+	}
+
+	/** Move the reference at 'from' to 'to', shifting the references between them by one.
+	See Swap for more docs */
+	void Move(int from, int to) {
+		if (from == to)
+			return;
+		int lo = min(from, to);
+		int count = max(from, to) - lo + 1;
+		std::vector<int> order(count);
+		for (int k = 0; k < count; k++)
+			order[k] = k;
+		if (from < to)
+			std::rotate(order.begin(), order.begin() + 1, order.end());
+		else
+			std::rotate(order.begin(), order.end() - 1, order.end());
+		Permute(lo, order);
+	}
+
+	/** Sort the references with the given comparator, which is called as less(REF_TYPE_T*, REF_TYPE_T*).
+	The sort is stable, and the whole reordering is recorded as a single undo.
+	See Swap for more docs */
+	template<typename LESS_T>
+	void Sort(LESS_T less) {
+		int count = Count();
+		std::vector<int> order(count);
+		for (int k = 0; k < count; k++)
+			order[k] = k;
+		std::stable_sort(order.begin(), order.end(), [&](int a, int b) -> bool {
+			return less(static_cast<REF_TYPE_T*>((*this)[a]), static_cast<REF_TYPE_T*>((*this)[b]));
+		});
+		Permute(0, order);
+	}
+
+	/** Replace the contents of the array with the targets [first, last).
+	The array is grown or shrunk in one batch, and the existing references are
+	reused in place.  References that already hold the right target are left
+	alone, so only the references that actually change are replaced.
+	The targets are type checked at compile time, so (unlike operator=)
+	there is no run-time cast per element.  With forward iterators the range
+	is measured first, and the array resized once.  Input iterators (such as
+	std::istream_iterator) are read once, appending one reference at a time.
+	\param first, last A range of pointers convertible to REF_TYPE_T*
+	\code
+	std::vector<INode*> nodes = ...;
+	m_nodes.Assign(nodes.begin(), nodes.end());
+	\endcode */
+	template<typename ITER_T>
+	void Assign(ITER_T first, ITER_T last) {
+		typedef typename std::iterator_traits<ITER_T>::value_type VALUE_T;
+		static_assert(std::is_convertible<VALUE_T, REF_TYPE_T*>::value, "RefArray::Assign - the range must hold pointers convertible to REF_TYPE_T*");
+		AssignRange(first, last, typename std::iterator_traits<ITER_T>::iterator_category());
+	}
+
+	/** Returns a read-only view of the targets in this array.
+	The view reads directly from the managers storage, so unlike ToTabArray nothing
+	is copied.  The view is invalidated when the array (or any other reference in
+	the same manager) is resized or reordered.  See RefArrayView */
+	RefArrayView<REF_TYPE_T> Targets() const {
+		int count = 0;
+		ReferenceTarget* const* pTargets = m_pMgr->GetArrayTargets(BASE_ID, count);
+		DbgAssert(count == Count());
+		return RefArrayView<REF_TYPE_T>(pTargets, count);
+	}
+
 	/** Allow directly converting to a Tab of naked pointers
 	This is function is provided to make converting old projects a little easier.  
 	It is not advised to use this function - its a better idea to maintain references by converting
@@ -393,12 +815,8 @@ public:
 	to another Tab array.  This function may be deprecated fairly soon. */
 	Tab<REF_TYPE_T*>& FromTabArray(Tab<REF_TYPE_T*>& rhs) 
 	{
-		// Set to match the number of items
-		SetCount(rhs.Count());
-
-		// Copy the references over.
-		for (int i = 0; i < Count(); i++)
-			(*this)[i] = rhs[i];
+		REF_TYPE_T** pFirst = (rhs.Count() > 0) ? rhs.Addr(0) : NULL;
+		Assign(pFirst, pFirst + rhs.Count());
 		return rhs;
 	}
 
@@ -418,3 +836,132 @@ public:
 		return FromTabArray(rhs);
 	}
 };
+
+/// \brief SparseRefArray is a RefArray whose indices do not change when references are removed.
+/// Removing a reference leaves a tombstone in its place: the slot is kept (with a NULL
+/// target) and is reused by the next Add.  This makes removal O(1), and any index held
+/// by client code stays valid until the next call to Compact.
+/// Compact removes all the tombstones, renumbering the remaining references in a single
+/// O(Count()) pass, at a time of the owners choosing.
+/// \code
+///		SparseRefArray<INode, INODE_TAB_REF> m_nodes;
+///		...
+///		int i = m_nodes.Add(pNode);
+///		m_nodes.Remove(j);	// i is still valid
+///		...
+///		m_nodes.Compact();	// Now i may have changed
+/// \endcode
+/// \sa RefArray
+/// \param REF_TYPE_T The type of the pointers to be referenced in this array
+/// \param BASE_ID The ID of the reference group managed by this array, see RefArray.
+template<typename REF_TYPE_T, int BASE_ID>
+class SparseRefArray {
+private:
+	RefArray<REF_TYPE_T, BASE_ID> m_array;
+	std::vector<bool> m_isTombstone;	// One entry per slot in m_array
+	std::vector<int> m_freeSlots;		// Tombstones, in the order they will be reused
+
+	// No default construction
+	SparseRefArray();
+	SparseRefArray(const SparseRefArray&);
+	SparseRefArray& operator=(const SparseRefArray&);
+public:
+
+	/** Contructs the Array, and ensures it is valid.
+	See RefArray::RefArray for more docs */
+	SparseRefArray(IReferenceManager& mgr, NotifyCallback* callback=NULL, DWORD messageFilter = kRefMsgFilterAll)
+		: m_array(mgr, callback, messageFilter)
+	{
+	}
+
+	/** Contructs the Array, with one callback shared by all its references.
+	The index passed to the callback is the (stable) index in this array.
+	See RefArray::RefArray for more docs */
+	SparseRefArray(IReferenceManager& mgr, const ArrayNotifyCallback& callback, DWORD messageFilter = kRefMsgFilterAll)
+		: m_array(mgr, callback, messageFilter)
+	{
+	}
+
+	/** Returns the number of slots, including tombstones.  
+	Valid indices are [0, Count()) */
+	int Count() const { return m_array.Count(); }
+
+	/** Returns the number of slots that are not tombstones */
+	int NumLive() const { return Count() - (int)m_freeSlots.size(); }
+
+	/** Returns true if slot i holds a reference (which may still be NULL), 
+	false if it is a tombstone */
+	bool IsLive(int i) const { return i >= 0 && i < Count() && !m_isTombstone[i]; }
+
+	/** Add a new reference, reusing a tombstone if there is one.
+	\return The index of the new reference */
+	int Add(REF_TYPE_T* pTarget)
+	{
+		if (!m_freeSlots.empty())
+		{
+			int i = m_freeSlots.back();
+			m_freeSlots.pop_back();
+			m_isTombstone[i] = false;
+			m_array[i] = pTarget;
+			return i;
+		}
+
+		m_array.Append(pTarget);
+		m_isTombstone.push_back(false);
+		return Count() - 1;
+	}
+
+	/** Remove the reference at i, leaving a tombstone.  
+	No other index is changed. */
+	void Remove(int i)
+	{
+		DbgAssert(IsLive(i));
+		if (!IsLive(i))
+			return;
+
+		m_array[i] = (REF_TYPE_T*)NULL;
+		m_isTombstone[i] = true;
+		m_freeSlots.push_back(i);
+	}
+
+	/** Removes all the tombstones.  The remaining references keep their order,
+	but their indices change.
+	\return The new number of slots */
+	int Compact()
+	{
+		if (m_freeSlots.empty())
+			return Count();
+
+		int newCount = m_array.Delete(m_isTombstone);
+		m_isTombstone.assign(newCount, false);
+		m_freeSlots.clear();
+		return newCount;
+	}
+
+	/** Release every reference */
+	void Clear()
+	{
+		m_array.SetCount(0);
+		m_isTombstone.clear();
+		m_freeSlots.clear();
+	}
+
+	/** Access the reference at i.  It is an error to access a tombstone. */
+	RefPtr<REF_TYPE_T, BASE_ID>& operator[](int i)
+	{
+		DbgAssert(IsLive(i));
+		return m_array[i];
+	}
+
+	/** Returns a read-only view of every slot.  Tombstones are NULL.  
+	See RefArray::Targets */
+	RefArrayView<REF_TYPE_T> Targets() const { return m_array.Targets(); }
+
+	/** Read the reference at i.  Tombstones are NULL. */
+	REF_TYPE_T* GetRef(int i) const
+	{
+		DbgAssert(i >= 0 && i < Count());
+		// Tab::operator[] is const, but returns a non-const item
+		return m_array[i].GetRef();
+	}
+};
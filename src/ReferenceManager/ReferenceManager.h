@@ -9,8 +9,14 @@
 #pragma once
 
 #include "IReferenceManager.h"
+#include "ArraySizeTree.h"
+#include "RefLayout.h"
+#include "SlabPool.h"
+#include "SmallArray.h"
+#include "TargetIndex.h"
+#include "RefMgrStats.h"
+#include "ConcurrentTargets.h"
 #include "../MaxVersionSelector.h"
-#include <Containers/Array.h>
 #include <vector>
 //=========================================================
 /// This class provides the implementation of the IReferenceManager and 
@@ -29,6 +35,8 @@
 /// of any Change notification messages sent by the reference targets.
 ///
 /// The template parameter Base_T is used as the Base class. 
+/// The optional template parameter Layout_T declares the references up front,
+/// see RefLayout.
 //=========================================================
 
 #if _MSC_VER > 1600
@@ -41,7 +49,7 @@
 
 using namespace std;
 
-template<typename Base_T, int USE_BASE_REF=0>
+template<typename Base_T, int USE_BASE_REF=0, typename Layout_T=DynamicRefLayout>
 class ReferenceManager 
     : public Base_T, public virtual IReferenceManager
 {
@@ -53,15 +61,164 @@ private:
     // This manages an array of reference targets. The template class "RefMgr" is not 
     // used because it may be deprecated in later versions of the 3ds Max 2010 SDK.
     // The class IRefTargContainer is not used because it does not support node targets,
-	MaxSDK::Array<RefInfo*> m_refs;
+	//
+	// The slot table is stored as parallel arrays, indexed by (reference index - kBaseIndex).
+	// The hot per-slot data (the target and flags) is packed, so GetReference and
+	// scans over the references stream through memory without touching the RefInfos.
+	// m_refs holds the cold data (callbacks and bookkeeping) for each slot.
+	// Only the slot table functions (GrowSlots, InsertSlots, RemoveSlots, SetSlot,
+	// ClearSlot) may change these, to keep them in step.
+	//
+	// Most classes have only a few references, so the first kNumInlineSlots
+	// slots are stored inside the manager, and only a manager with more
+	// references allocates them from the heap.
+	enum { kNumInlineSlots = 6 };
+	SmallArray<ReferenceTarget*, kNumInlineSlots> m_targets;
+	SmallArray<BYTE, kNumInlineSlots> m_slotFlags;
+	SmallArray<RefInfo*, kNumInlineSlots> m_refs;
+
+	enum kSlotFlags
+	{
+		kSlotUsed		= 1 << 0,	// A reference has been registered in this slot
+		kSlotWeak		= 1 << 1,	// Weak Reference
+		kSlotPersisted	= 1 << 2,	// Is the reference saved/loaded?
+		kSlotReleased	= 1 << 3,	// Marked for removal by RemoveReleasedSlots
+	};
 
-	// Stores the number of references in each array
-	std::vector<size_t> m_arraySizes;
+	// Stores the number of references in each array.  This is
+	// a prefix-sum tree, so finding the first reference index of
+	// an array is O(log arrays) rather than a sum over every array below it.
+	ArraySizeTree m_arraySizes;
+
+
+	// Every RefInfo we own is allocated from here.  Registering and
+	// releasing references recycles records instead of hitting the heap.
+	// Most classes have only a few references, so the first slab holds 4
+	// (or exactly the references declared by a layout).  RefArrays growing
+	// in bulk reserve what they need.  The pool keeps its high-water mark:
+	// shrinking a large RefArray recycles its records for later references,
+	// but the memory is only freed with the manager.
+	SlabPool<RefInfo, 4, 1024> m_infoPool;
+
+	// The references declared by our layout.  Their slots are reserved on
+	// construction, so they are stored like any other reference.
+	enum {
+		kNumLayoutRefs = Layout_T::kNumStaticRefs,
+		kNumLayoutArrays = Layout_T::kNumArrays,
+	};
 
 	// Stores the index of the last static reference
 	// Every dynamic reference must be at a higher index than this.
 	size_t m_baseDynIdx;
 
+	// Maps each (non-NULL) target to every RefInfo currently referencing it.
+	// This turns GetReferenceIndex(ReferenceTarget*) into a hash lookup
+	// instead of a scan over NumRefs().  It is kept in sync by SetReference
+	// (and NotifyTargetDeleted).
+	// Slot indices are read from RefInfo::m_slot, so shifting m_refs
+	// does not invalidate it.  The RefInfos of a target are chained through
+	// the RefInfos themselves, so indexing a reference never allocates.
+	typedef TargetIndex<ReferenceTarget, RefInfo> TargetSlotMap;
+	TargetSlotMap m_targetSlots;
+
+	// The RefInfos being sent REFMSG_TARGET_DELETED, see NotifyTargetDeleted.
+	// These nest if a callback deletes another target, hence the chain.
+	struct DeletedTargetDispatch
+	{
+		std::vector<RefInfo*> m_infos;
+		DeletedTargetDispatch* m_pOuter;
+		DeletedTargetDispatch*& m_head;
+
+		DeletedTargetDispatch(DeletedTargetDispatch*& head) : m_pOuter(head), m_head(head) { m_head = this; }
+		~DeletedTargetDispatch() { m_head = m_pOuter; }
+	};
+	DeletedTargetDispatch* m_pDeletedDispatch;
+
+	int m_snapshotUpdateDepth;	// The number of nested SnapshotUpdates and notification deferrals
+
+#ifdef REFMGR_ENABLE_STATS
+	// Instrumentation, see RefMgrStats.h
+	RefMgrStats m_stats;
+	int m_statNotifyDepth;	// The number of nested NotifyRefChanged calls being timed
+#endif
+
+	// The side table behind WeakHandle.  Entries are reused, and each
+	// reuse bumps its generation so older handles to it no longer resolve.
+	struct WeakHandleEntry
+	{
+		ReferenceTarget* m_target;	// The target when the handle was made.  Never dereferenced until
+									// m_animHandle has been checked.
+		AnimHandle m_animHandle;	// The targets (never reused) AnimHandle
+		DWORD m_generation;			// Incremented whenever this entry is released
+	};
+
+	// A dirty reference, and the changes it has accumulated
+	struct DirtyEntry
+	{
+		RefInfo* m_pInfo;
+		PartID m_parts;		// The PartIDs of every REFMSG_CHANGE OR'd together
+		Interval m_valid;	// The intersection of the change intervals of every REFMSG_CHANGE
+	};
+
+	// The state of the features most managers never use: deferred notifications,
+	// dirty tracking, weak handles and concurrent reads.  This is allocated by
+	// GetRareState when one of them is first used, and kept until we are deleted.
+	// So a manager that uses none of them pays for one pointer.
+	struct RareState
+	{
+		// While m_deferDepth > 0, REFMSG_CHANGE messages are not sent to the
+		// callbacks immediately.  Instead each RefInfo records them (see
+		// RefInfo::kIsPending) and is queued here to be notified once when
+		// the outermost deferral ends.  Released RefInfos are NULL'd in the queue.
+		int m_deferDepth;
+		bool m_isFlushing;
+		std::vector<RefInfo*> m_pendingNotifies;
+
+		// While m_trackDirty, every reference whose target sends REFMSG_CHANGE 
+		// is flagged (RefInfo::kIsDirty) and listed here with its accumulated
+		// changes, until acknowledged.  RefInfo::m_dirtyIdx is its index here.
+		bool m_trackDirty;
+		std::vector<DirtyEntry> m_dirtyInfos;
+
+		// The side table behind WeakHandle, and its unused entries
+		std::vector<WeakHandleEntry> m_weakHandles;
+		std::vector<int> m_freeWeakHandles;
+
+#ifdef REFMGR_HAS_CONCURRENT_READS
+		// The copies of m_targets published for GetReferenceConcurrent.
+		// Only allocated while concurrent reads are enabled.
+		ConcurrentTargets* m_pConcurrent;
+#endif
+
+		RareState()
+			: m_deferDepth(0)
+			, m_isFlushing(false)
+			, m_trackDirty(false)
+#ifdef REFMGR_HAS_CONCURRENT_READS
+			, m_pConcurrent(NULL)
+#endif
+		{ }
+	};
+	RareState* m_pRareState;
+
+	// Publishes a new snapshot (if required) when the outermost change completes,
+	// so worker threads never see a partially updated slot table.
+	class SnapshotUpdate
+	{
+		ReferenceManager& m_mgr;
+		SnapshotUpdate& operator=(const SnapshotUpdate&);
+	public:
+		SnapshotUpdate(ReferenceManager& mgr) : m_mgr(mgr) { m_mgr.m_snapshotUpdateDepth++; }
+		~SnapshotUpdate() { End(m_mgr); }
+
+		// Also ends the update a deferral holds open, see BeginDeferNotifications
+		static void End(ReferenceManager& mgr)
+		{
+			if (--mgr.m_snapshotUpdateDepth == 0)
+				mgr.PublishSnapshotIfDirty();
+		}
+	};
+
 	// disable copy
 	ReferenceManager& operator=(ReferenceManager& rhs);
 
@@ -109,7 +266,29 @@ protected:
     ReferenceManager()
         : Base_T()
 		, m_baseDynIdx(INT_MAX) // Until we register an array, all refs are static
+		, m_pDeletedDispatch(NULL)
+		, m_snapshotUpdateDepth(0)
+#ifdef REFMGR_ENABLE_STATS
+		, m_statNotifyDepth(0)
+#endif
+		, m_pRareState(NULL)
     {
+
+		// Reserve the slots declared by our layout, and size the
+		// first slab of the pool to hold exactly those references.
+		if (kNumLayoutRefs > 0)
+		{
+			GrowSlots(kNumLayoutRefs);
+			ReserveInfos(kNumLayoutRefs);
+		}
+		if (kNumLayoutArrays > 0)
+		{
+			// Declared arrays follow immediately after the static
+			// references, and start empty.
+			m_baseDynIdx = kNumLayoutRefs;
+			m_arraySizes.Append(kNumLayoutArrays, 0);
+		}
+
 		// Compiler safety - Ensure that Base_T class to derive from ReferenceTarget somehow
 		ReferenceMaker::GetReference(0);
     }
@@ -127,8 +306,14 @@ protected:
 			DbgAssert(m_refs[i] == NULL && "LEAK - A Reference was not released!");
 		}
 
+#ifdef REFMGR_HAS_CONCURRENT_READS
+		EnableConcurrentReads(false);
+#endif
+
         // Informs 3ds Max that it is safe to delete the all references from and to this object
-        DeleteAllRefs();
+        this->DeleteAllRefs();
+
+		delete m_pRareState;
     }
 
 	// This function allows us to refer to ourselves
@@ -157,6 +342,8 @@ public:
 	/// Returns a pointer to the i'th reference
     virtual RefTargetHandle GetReference(int i) FINAL
     {
+		REFMGR_STAT_ADD(numIndexLookups, 1);
+
 #if kBaseIndex != 0 // Compiling this with kBaseIndex == 0 produces a warning (conditional expression is constant)
 		// Allow for parent classes with references
 		if (kBaseIndex >= 0 && i < kBaseIndex)
@@ -167,10 +354,20 @@ public:
         //if (!IsValidReferenceIndex(i))
         //    return NULL;
 
-		RefInfo* pInfo = GetInfo(i);
-		return (pInfo != NULL) ? pInfo->m_target : NULL;
+		size_t pos = size_t(i - kBaseIndex);
+		return (pos < m_targets.length()) ? m_targets[pos] : NULL;
     }
 
+	/// Returns the static reference ID declared by our RefLayout.  Its slot is
+	/// reserved on construction, so unlike GetReference there is no range
+	/// check or base class test: this is a single load from the slot table.
+	template<int ID>
+	ReferenceTarget* GetStaticReference() const
+	{
+		static_assert(ID >= 0 && ID < kNumLayoutRefs, "GetStaticReference - ID is not a static reference of this manager's RefLayout");
+		return m_targets.asArrayPtr()[ID];
+	}
+
 	/// Returns true if the specified target is a real dependency.
 	virtual BOOL IsRealDependency(ReferenceTarget* rtarg)
 	{
@@ -178,8 +375,8 @@ public:
 		if (n < kBaseIndex)
 			return Base_T::IsRealDependency(rtarg);
 
-		RefInfo* pInfo = GetInfo(n);
-		return (pInfo != NULL) ? !pInfo->TestFlag(RefInfo::kIsWeak) : FALSE;
+		BYTE flags = GetSlotFlags(n);
+		return (flags & kSlotUsed) ? (flags & kSlotWeak) == 0 : FALSE;
 	}
 
 	/// Should the reference to the specified target be saved?
@@ -189,8 +386,8 @@ public:
 		if (n < kBaseIndex)
 			return Base_T::IsRealDependency(rtarg);
 
-		RefInfo* pInfo = GetInfo(n);
-		return (pInfo != NULL) ? pInfo->TestFlag(RefInfo::kIsPersisted) : TRUE;
+		BYTE flags = GetSlotFlags(n);
+		return (flags & kSlotUsed) ? (flags & kSlotPersisted) != 0 : TRUE;
 	}
 
 protected:
@@ -205,20 +402,74 @@ protected:
         if (!from || !to || from == to)
             return;
 
-	    for (int i=0; i < from->NumRefs(); ++i)
-        {
-            ReferenceTarget* fromTarget = from->GetReference(i);
-            
-            // Do not clone weak references, just copy them
-            if (from->IsRealDependency(fromTarget))
-                to->ReplaceReference(i, remap.CloneRef(fromTarget));
-            else
-                to->ReplaceReference(i, fromTarget);
-        }
+		// If we are cloning between managers, we can read the weak flag 
+		// straight from each reference, rather than looking it up by target.
+		ReferenceManager* pFromMgr = dynamic_cast<ReferenceManager*>(from);
+		ReferenceManager* pToMgr = dynamic_cast<ReferenceManager*>(to);
+		if (pFromMgr != NULL && pToMgr != NULL)
+		{
+			pFromMgr->CloneReferences(*pToMgr, remap);
+		}
+		else
+		{
+			for (int i=0; i < from->NumRefs(); ++i)
+			{
+				ReferenceTarget* fromTarget = from->GetReference(i);
+	            
+				// Do not clone weak references, just copy them
+				if (from->IsRealDependency(fromTarget))
+					to->ReplaceReference(i, remap.CloneRef(fromTarget));
+				else
+					to->ReplaceReference(i, fromTarget);
+			}
+		}
 
         Base_T::BaseClone(from, to, remap);
     }
 
+	// Clone (or copy, for weak references) every reference we hold onto 'to'.
+	// 'to' must already have registered the same references we have, ie - 
+	// any RefArrays must have been sized to match before calling BaseClone.
+	// This walks our RefInfo records directly, so it is O(NumRefs()).
+	void CloneReferences(ReferenceManager& to, RemapDir& remap)
+	{
+		int numRefs = NumRefs();
+		DbgAssert(to.NumRefs() == numRefs && "ERROR: Clone target has a different number of references");
+		if (to.NumRefs() < numRefs)
+			numRefs = to.NumRefs();
+
+		// Size the destination's bookkeeping once, up front
+		to.m_targetSlots.reserve(m_targetSlots.size());
+
+		// Parent class references are not ours to walk
+		for (int i = 0; i < kBaseIndex; ++i)
+		{
+			ReferenceTarget* fromTarget = GetReference(i);
+			if (Base_T::IsRealDependency(fromTarget))
+				to.ReplaceReference(i, remap.CloneRef(fromTarget));
+			else
+				to.ReplaceReference(i, fromTarget);
+		}
+
+		for (int i = kBaseIndex; i < numRefs; ++i)
+		{
+			size_t pos = size_t(i - kBaseIndex);
+			BYTE flags = m_slotFlags[pos];
+			if ((flags & kSlotUsed) == 0)
+				continue;
+
+			// Do not clone weak references, just copy them
+			ReferenceTarget* fromTarget = m_targets[pos];
+			ReferenceTarget* toTarget = fromTarget;
+			if (fromTarget != NULL && (flags & kSlotWeak) == 0)
+				toTarget = remap.CloneRef(fromTarget);
+
+			// No need to tell 3ds Max about references it already has
+			if (to.GetReference(i) != toTarget)
+				to.ReplaceReference(i, toTarget);
+		}
+	}
+
 	// A default implementation simply manages reference deletion.  Override this function
 	// to handle any specific reference changes.
     virtual RefResult NOTIFY_REF_CHANGED_FN_DECL FINAL
@@ -227,12 +478,31 @@ protected:
 #if MAX_VERSION_MAJOR > 16
 		UNUSED_PARAM(propagate);
 #endif
+		REFMGR_STAT_ADD(numNotifies, 1);
+		REFMGR_STAT_TIME_NOTIFY();
+
+		if (message == REFMSG_CHANGE && hTarget != NULL && IsDirtyTrackingEnabled())
+			MarkDirty(hTarget, changeInt, partID);
+
 		int n = GetReferenceIndex(hTarget);
-		if (n >= kBaseIndex)
+		if (n >= kBaseIndex && message != REFMSG_TARGET_DELETED)
 		{
 			RefInfo* pInfo = GetInfo(n);
-			if (pInfo != NULL && pInfo->m_callback != NULL)
-				(*pInfo->m_callback)(message, partID);
+			if (pInfo != NULL && pInfo->HasCallback())
+			{
+				if (message == REFMSG_CHANGE && IsDeferringNotifications())
+				{
+					// Merge this change with any others until the deferral ends
+					DeferNotification(pInfo, partID);
+				}
+				else
+				{
+					// Anything still waiting was sent before this message
+					if (pInfo->TestFlag(RefInfo::kIsPending))
+						DispatchPendingNotification(pInfo);
+					DispatchNotification(pInfo, message, partID);
+				}
+			}
 		}
 
 		switch (message) 
@@ -242,7 +512,10 @@ protected:
             if (hTarget != NULL)
             {
                 n = GetReferenceIndex(hTarget);
-                DbgAssert(n >= 0 && "Internal error, reference could not be found");
+				// 3ds Max sends this once for each of our references to the target,
+				// but the first message NULLs them all.  Nothing is left to do.
+				if (n < 0)
+					return REF_SUCCEED;
 
 #if kBaseIndex > 0 // Only compile this in if we have base references - otherwise we get compiler errors!
 				// Its possible that our parent class 
@@ -252,7 +525,12 @@ protected:
 					Base_T::NotifyRefChanged(changeInt, hTarget, partID, message );
 #endif
 				// NULL the pointer.
-				SetReference(n, NULL);
+				if (n >= 0 && n < kBaseIndex)
+					SetReference(n, NULL);
+
+				// The target may be in any number of our slots.
+				// Notify and NULL them all.
+				NotifyTargetDeleted(hTarget, partID);
 				return REF_SUCCEED;
             }
         }
@@ -260,23 +538,583 @@ protected:
         return REF_SUCCEED;
     }
 
+	// Sends REFMSG_TARGET_DELETED to the callback of every reference to hTarget,
+	// then NULLs them all.  This is O(references to hTarget), not O(NumRefs()).
+	void NotifyTargetDeleted(ReferenceTarget* hTarget, PartID& partID)
+	{
+		if (m_targetSlots.Find(hTarget) == NULL)
+			return;
+
+		SnapshotUpdate snapshotUpdate(*this);
+		// Callbacks may release references, so gather the affected
+		// RefInfos up front.  FreeInfo NULLs any released while we run.
+		DeletedTargetDispatch dispatch(m_pDeletedDispatch);
+		for (RefInfo* pInfo = m_targetSlots.Find(hTarget); pInfo != NULL; pInfo = pInfo->m_pNextSameTarget)
+			dispatch.m_infos.push_back(pInfo);
+
+		for (size_t i = 0; i < dispatch.m_infos.size(); i++)
+		{
+			RefInfo* pInfo = dispatch.m_infos[i];
+			if (pInfo == NULL || !pInfo->HasCallback())
+				continue;
+
+			// Anything still waiting was sent before this message
+			if (pInfo->TestFlag(RefInfo::kIsPending))
+				DispatchPendingNotification(pInfo);
+			DispatchNotification(pInfo, REFMSG_TARGET_DELETED, partID);
+		}
+
+		// NULL every slot that (still) points to the target, and drop them
+		// from the index in one go.  The callbacks may have changed the set.
+		for (RefInfo* pInfo = m_targetSlots.Find(hTarget); pInfo != NULL; pInfo = pInfo->m_pNextSameTarget)
+		{
+			pInfo->SetTarget(NULL);
+			m_targets[pInfo->m_slot - kBaseIndex] = NULL;
+			MarkSnapshotDirty();
+		}
+		m_targetSlots.RemoveAll(hTarget);
+	}
+
 private:
 
 	// Internal only.  Do not call this function.
 	virtual void SetReference(int i, RefTargetHandle rtarg) FINAL
 	{ 
+		SnapshotUpdate snapshotUpdate(*this);
 		DbgAssert(IsValidReferenceIndex(i));
 		if(i < kBaseIndex)
 			Base_T::SetReference(i, rtarg);
 		else
 		{
 			RefInfo* pInfo = GetInfo(i);
-			if (pInfo != NULL) pInfo->m_target = rtarg;
+			if (pInfo != NULL && pInfo->m_target != rtarg)
+			{
+				UnindexTarget(pInfo->m_target, pInfo);
+				pInfo->SetTarget(rtarg);
+				m_targets[i - kBaseIndex] = rtarg;
+				MarkSnapshotDirty();
+				IndexTarget(rtarg, pInfo);
+			}
 		}
 	}
 
 #pragma endregion // ReferenceMaker functions
 
+    //========================================================================
+#pragma region // Deferred notifications
+
+public:
+
+	/// Starts deferring REFMSG_CHANGE notifications to the reference callbacks.
+	/// Until the matching EndDeferNotifications, changes are not sent to the
+	/// callbacks.  Instead, each reference remembers that it has changed (and
+	/// which parts, the PartIDs of every change are OR'd together).  When the
+	/// outermost deferral ends, each changed reference is sent a single REFMSG_CHANGE.
+	/// This is useful around batch edits that change many targets many times.
+	/// Calls may be nested.  All other messages are still delivered immediately, 
+	/// after any change already waiting for that reference.
+	/// Note that the return value of a deferred callback is ignored.
+	/// If concurrent reads are enabled, the whole deferral is also published
+	/// as one change: GetReferenceConcurrent sees the references as they were
+	/// before the outermost deferral began until it ends.  So a batch of n
+	/// changes copies the references once, rather than n times.
+	void BeginDeferNotifications()
+	{
+		GetRareState().m_deferDepth++;
+		m_snapshotUpdateDepth++;
+	}
+
+	/// Ends a deferral started with BeginDeferNotifications.  If this is the
+	/// outermost deferral, all waiting changes are delivered.
+	void EndDeferNotifications()
+	{
+		DbgAssert(IsDeferringNotifications());
+		if (!IsDeferringNotifications())
+			return;
+		if (--m_pRareState->m_deferDepth == 0)
+			FlushNotifications();
+		// Publish after the callbacks, so any changes they make are included
+		SnapshotUpdate::End(*this);
+	}
+
+	/// Returns true if REFMSG_CHANGE notifications are currently being deferred
+	bool IsDeferringNotifications() const { return m_pRareState != NULL && m_pRareState->m_deferDepth > 0; }
+
+	/// Immediately delivers any deferred changes.  This may be called
+	/// while deferring, in which case subsequent changes are deferred again.
+	void FlushNotifications()
+	{
+		// Notifications can cause more notifications, even re-entrant flushes.
+		// The outermost flush picks up anything queued while it runs
+		if (m_pRareState == NULL || m_pRareState->m_isFlushing)
+			return;
+
+		std::vector<RefInfo*>& pendingNotifies = m_pRareState->m_pendingNotifies;
+		m_pRareState->m_isFlushing = true;
+		// Do not cache the size, callbacks may queue more
+		for (size_t i = 0; i < pendingNotifies.size(); i++)
+		{
+			RefInfo* pInfo = pendingNotifies[i];
+			if (pInfo != NULL)
+				DispatchPendingNotification(pInfo);
+		}
+		pendingNotifies.clear();
+		m_pRareState->m_isFlushing = false;
+	}
+
+	/// Defers notifications for the lifetime of this object.
+	/// \code
+	/// {
+	///		ReferenceManager::DeferNotifyScope defer(*this);
+	///		for (int i = 0; i < nodes.Count(); i++)
+	///			nodes[i]->SetNodeTM(t, tm); // Our callback is notified once per node, below
+	/// }
+	/// \endcode
+	class DeferNotifyScope
+	{
+		ReferenceManager& m_mgr;
+		// disable copy
+		DeferNotifyScope(const DeferNotifyScope&);
+		DeferNotifyScope& operator=(const DeferNotifyScope&);
+	public:
+		DeferNotifyScope(ReferenceManager& mgr) : m_mgr(mgr) { m_mgr.BeginDeferNotifications(); }
+		~DeferNotifyScope() { m_mgr.EndDeferNotifications(); }
+	};
+
+private:
+
+	// Send message to pInfo's callback, if its filter allows it.
+	RefResult DispatchNotification(RefInfo* pInfo, RefMessage message, PartID& partID)
+	{
+		// Skip callbacks that are not interested in this message
+		RefMessageType msgType = GetRefMessageType(message);
+		if ((pInfo->m_messageFilter & (1 << msgType)) == 0)
+		{
+			CountDispatch(pInfo, msgType, true);
+			return REF_SUCCEED;
+		}
+
+		CountDispatch(pInfo, msgType, false);
+		if (pInfo->m_arrayCallback != NULL)
+			return (*pInfo->m_arrayCallback)(GetArrayElementIndex(pInfo), message, partID);
+		return (*pInfo->m_callback)(message, partID);
+	}
+
+	// Count a message passed to pInfo's callback, or skipped by its filter
+	void CountDispatch(RefInfo* pInfo, RefMessageType msgType, bool filtered)
+	{
+#ifdef REFMGR_ENABLE_STATS
+		if (filtered)
+		{
+			pInfo->m_numFiltered++;
+			REFMGR_STAT_ADD(numFiltered[msgType], 1);
+		}
+		else
+		{
+			pInfo->m_numDispatched++;
+			REFMGR_STAT_ADD(numCallbacks[msgType], 1);
+		}
+#else
+		UNUSED_PARAM(pInfo);
+		UNUSED_PARAM(msgType);
+		UNUSED_PARAM(filtered);
+#endif
+	}
+
+	// Returns the index of pInfo within its RefArray
+	int GetArrayElementIndex(RefInfo* pInfo)
+	{
+		DbgAssert(size_t(pInfo->m_slot) >= m_baseDynIdx);
+		size_t offsetInArray = 0;
+		m_arraySizes.Find(pInfo->m_slot - m_baseDynIdx, offsetInArray);
+		return int(offsetInArray);
+	}
+
+	// Record a REFMSG_CHANGE to be sent later
+	void DeferNotification(RefInfo* pInfo, PartID partID)
+	{
+		// If the callback doesn't want it, no need to remember it.
+		if ((pInfo->m_messageFilter & kRefMsgFilterChange) == 0)
+		{
+			CountDispatch(pInfo, kRefMsgChange, true);
+			return;
+		}
+
+		if (!pInfo->TestFlag(RefInfo::kIsPending))
+		{
+			pInfo->SetFlag(RefInfo::kIsPending);
+			pInfo->m_pendingParts = 0;
+			m_pRareState->m_pendingNotifies.push_back(pInfo);
+		}
+		pInfo->m_pendingParts |= partID;
+	}
+
+	// Send the merged REFMSG_CHANGE pInfo has been waiting on
+	void DispatchPendingNotification(RefInfo* pInfo)
+	{
+		DbgAssert(pInfo->TestFlag(RefInfo::kIsPending));
+		pInfo->ClearFlag(RefInfo::kIsPending);
+		PartID partID = pInfo->m_pendingParts;
+		pInfo->m_pendingParts = 0;
+		// The reference may have been cleared since
+		if (pInfo->HasCallback())
+			DispatchNotification(pInfo, REFMSG_CHANGE, partID);
+	}
+
+	// pInfo is being released, make sure we don't try to notify it later
+	void CancelPendingNotification(RefInfo* pInfo)
+	{
+		if (!pInfo->TestFlag(RefInfo::kIsPending))
+			return;
+
+		pInfo->ClearFlag(RefInfo::kIsPending);
+		std::vector<RefInfo*>& pendingNotifies = m_pRareState->m_pendingNotifies;
+		for (size_t i = 0; i < pendingNotifies.size(); i++)
+		{
+			if (pendingNotifies[i] == pInfo)
+			{
+				pendingNotifies[i] = NULL;
+				break;
+			}
+		}
+	}
+
+	// The references [firstSlot, firstSlot + count) are being released.
+	// One pass over the queue, rather than one per reference.
+	void CancelPendingNotifications(int firstSlot, int count)
+	{
+		if (m_pRareState == NULL)
+			return;
+
+		std::vector<RefInfo*>& pendingNotifies = m_pRareState->m_pendingNotifies;
+		for (size_t i = 0; i < pendingNotifies.size(); i++)
+		{
+			RefInfo* pInfo = pendingNotifies[i];
+			if (pInfo != NULL && pInfo->m_slot >= firstSlot && pInfo->m_slot < firstSlot + count)
+			{
+				pInfo->ClearFlag(RefInfo::kIsPending);
+				pendingNotifies[i] = NULL;
+			}
+		}
+	}
+
+#pragma endregion // Deferred notifications
+
+    //========================================================================
+#pragma region // Concurrent reads
+
+#ifdef REFMGR_HAS_CONCURRENT_READS
+public:
+
+	/// Enables GetReferenceConcurrent.  While enabled, every change to our
+	/// references publishes a new, immutable copy of the reference targets
+	/// for other threads to read.  This costs O(NumRefs()) per change, 
+	/// so it is off by default.  See ConcurrentTargets.
+	/// Appending n references one at a time therefore costs O(n^2).  Either
+	/// enable this after building the references, or make the changes
+	/// inside a DeferNotifyScope, which publishes them as a single change.
+	/// This must be called from the main thread, while no other thread is reading.
+	/// (Not available with Visual Studio 2010 and older)
+	void EnableConcurrentReads(bool enable)
+	{
+		if (enable == IsConcurrentReadEnabled())
+			return;
+		if (enable)
+			GetRareState().m_pConcurrent = new ConcurrentTargets(m_targets.asArrayPtr(), m_targets.length());
+		else
+		{
+			delete m_pRareState->m_pConcurrent;
+			m_pRareState->m_pConcurrent = NULL;
+		}
+	}
+
+	/// Returns true if GetReferenceConcurrent is enabled
+	bool IsConcurrentReadEnabled() const { return GetConcurrent() != NULL; }
+
+	/// Returns reference i.  Unlike GetReference, this may be called from any
+	/// thread, even while the main thread is adding, removing or changing our
+	/// references.  It returns the target as of the last completed change, and
+	/// takes no lock.  EnableConcurrentReads must have been called first.
+	/// Base class references (i < kBaseIndex) are read from the base class,
+	/// and are not protected.
+	ReferenceTarget* GetReferenceConcurrent(int i)
+	{
+		if (i < kBaseIndex)
+			return Base_T::GetReference(i);
+
+		ConcurrentTargets* pConcurrent = GetConcurrent();
+		DbgAssert(pConcurrent != NULL && "ERROR: Concurrent reads are not enabled");
+		if (pConcurrent == NULL)
+			return NULL;
+		ConcurrentTargets::Reader reader(*pConcurrent);
+		return reader.GetTarget(size_t(i - kBaseIndex));
+	}
+
+	/// Returns NumRefs(), as seen by GetReferenceConcurrent.  
+	/// This may be called from any thread.
+	int NumRefsConcurrent()
+	{
+		ConcurrentTargets* pConcurrent = GetConcurrent();
+		if (pConcurrent == NULL)
+			return kBaseIndex;
+		ConcurrentTargets::Reader reader(*pConcurrent);
+		return kBaseIndex + int(reader.NumTargets());
+	}
+
+private:
+
+	ConcurrentTargets* GetConcurrent() const { return (m_pRareState != NULL) ? m_pRareState->m_pConcurrent : NULL; }
+#endif // REFMGR_HAS_CONCURRENT_READS
+
+private:
+
+	// Called whenever m_targets changes
+	void MarkSnapshotDirty()
+	{
+#ifdef REFMGR_HAS_CONCURRENT_READS
+		ConcurrentTargets* pConcurrent = GetConcurrent();
+		if (pConcurrent != NULL)
+			pConcurrent->MarkDirty();
+#endif
+	}
+
+	// Publish a copy of m_targets, if concurrent reads are
+	// enabled and it has changed since the last copy
+	void PublishSnapshotIfDirty()
+	{
+#ifdef REFMGR_HAS_CONCURRENT_READS
+		ConcurrentTargets* pConcurrent = GetConcurrent();
+		if (pConcurrent != NULL && pConcurrent->IsDirty())
+			pConcurrent->Publish(m_targets.asArrayPtr(), m_targets.length());
+#endif
+	}
+
+#pragma endregion // Concurrent reads
+
+    //========================================================================
+#pragma region // Dirty tracking
+
+public:
+
+	/// Describes a reference that has changed since it was last acknowledged
+	struct DirtyReference
+	{
+		int m_refIdx;		// The reference index
+		PartID m_parts;		// The PartIDs of every change, OR'd together
+		Interval m_valid;	// The intersection of the change intervals of every change
+	};
+
+	/// Starts (or stops) recording which references change.  While enabled, 
+	/// each REFMSG_CHANGE marks every reference to its target as dirty, 
+	/// accumulating its PartID and change interval, until the owner 
+	/// acknowledges it.  This lets an owner re-evaluate only the inputs that 
+	/// have changed.  Disabling tracking acknowledges everything.
+	void EnableDirtyTracking(bool enable)
+	{
+		if (enable)
+			GetRareState().m_trackDirty = true;
+		else if (m_pRareState != NULL)
+		{
+			AcknowledgeDirtyReferences();
+			m_pRareState->m_trackDirty = false;
+		}
+	}
+
+	/// Returns true if changes are being recorded
+	bool IsDirtyTrackingEnabled() const { return m_pRareState != NULL && m_pRareState->m_trackDirty; }
+
+	/// Returns the number of dirty references.  
+	int NumDirtyReferences() const { return (m_pRareState != NULL) ? int(m_pRareState->m_dirtyInfos.size()) : 0; }
+
+	/// Returns dirty reference n, where 0 <= n < NumDirtyReferences().
+	/// The dirty references are in no particular order.  Iterating them
+	/// is O(dirty references), not O(NumRefs()).
+	DirtyReference GetDirtyReference(int n)
+	{
+		DbgAssert(n >= 0 && n < NumDirtyReferences());
+		const DirtyEntry& entry = m_pRareState->m_dirtyInfos[n];
+		DirtyReference dirty;
+		dirty.m_refIdx = entry.m_pInfo->m_slot;
+		dirty.m_parts = entry.m_parts;
+		dirty.m_valid = entry.m_valid;
+		return dirty;
+	}
+
+	/// Returns true if reference i has changed since it was last acknowledged.
+	/// If so, and parts or valid is not NULL, they receive its accumulated changes.
+	bool IsReferenceDirty(int i, PartID* parts = NULL, Interval* valid = NULL)
+	{
+		RefInfo* pInfo = GetInfo(i);
+		if (pInfo == NULL || !pInfo->TestFlag(RefInfo::kIsDirty))
+			return false;
+		const DirtyEntry& entry = m_pRareState->m_dirtyInfos[pInfo->m_dirtyIdx];
+		if (parts != NULL)
+			*parts = entry.m_parts;
+		if (valid != NULL)
+			*valid = entry.m_valid;
+		return true;
+	}
+
+	/// Marks reference i as clean.  Note this changes the order of the
+	/// dirty references, so when acknowledging while iterating, iterate backwards.
+	void AcknowledgeDirtyReference(int i)
+	{
+		RefInfo* pInfo = GetInfo(i);
+		if (pInfo != NULL)
+			ClearDirty(pInfo);
+	}
+
+	/// Marks every reference as clean
+	void AcknowledgeDirtyReferences()
+	{
+		if (m_pRareState == NULL)
+			return;
+
+		std::vector<DirtyEntry>& dirtyInfos = m_pRareState->m_dirtyInfos;
+		for (size_t i = 0; i < dirtyInfos.size(); i++)
+		{
+			dirtyInfos[i].m_pInfo->ClearFlag(RefInfo::kIsDirty);
+			dirtyInfos[i].m_pInfo->m_dirtyIdx = -1;
+		}
+		dirtyInfos.clear();
+	}
+
+private:
+
+	// Record a REFMSG_CHANGE from hTarget on every reference to it
+	void MarkDirty(ReferenceTarget* hTarget, const Interval& changeInt, PartID partID)
+	{
+		std::vector<DirtyEntry>& dirtyInfos = m_pRareState->m_dirtyInfos;
+		for (RefInfo* pInfo = m_targetSlots.Find(hTarget); pInfo != NULL; pInfo = pInfo->m_pNextSameTarget)
+		{
+			if (!pInfo->TestFlag(RefInfo::kIsDirty))
+			{
+				pInfo->SetFlag(RefInfo::kIsDirty);
+				pInfo->m_dirtyIdx = int(dirtyInfos.size());
+				DirtyEntry entry = { pInfo, 0, FOREVER };
+				dirtyInfos.push_back(entry);
+			}
+			DirtyEntry& entry = dirtyInfos[pInfo->m_dirtyIdx];
+			entry.m_parts |= partID;
+			entry.m_valid &= changeInt;
+		}
+	}
+
+	// Remove pInfo from the dirty list
+	void ClearDirty(RefInfo* pInfo)
+	{
+		if (!pInfo->TestFlag(RefInfo::kIsDirty))
+			return;
+
+		pInfo->ClearFlag(RefInfo::kIsDirty);
+
+		// Order doesn't matter, so move the last entry into our place
+		std::vector<DirtyEntry>& dirtyInfos = m_pRareState->m_dirtyInfos;
+		int idx = pInfo->m_dirtyIdx;
+		DbgAssert(idx >= 0 && size_t(idx) < dirtyInfos.size() && dirtyInfos[idx].m_pInfo == pInfo);
+		dirtyInfos[idx] = dirtyInfos.back();
+		dirtyInfos[idx].m_pInfo->m_dirtyIdx = idx;
+		dirtyInfos.pop_back();
+		pInfo->m_dirtyIdx = -1;
+	}
+
+#pragma endregion // Dirty tracking
+
+    //========================================================================
+#pragma region // Weak handles
+
+public:
+
+	/// A lightweight, non-owning handle to a ReferenceTarget, issued by MakeWeakHandle.
+	/// Unlike WeakRefPtr, a handle uses no reference slot or RefInfo, and is not sent
+	/// any reference messages.  It can only be used to find out whether its target
+	/// is still alive, and if so to get it.  This suits large caches of targets that
+	/// may be deleted (eg a list of nodes for display).  Handles are plain values, and
+	/// may be freely copied.  They are only valid on the manager that issued them.
+	struct WeakHandle
+	{
+		int m_index;		// Into the managers side table
+		DWORD m_generation;	// Must match the table entry.  0 is never issued.
+
+		WeakHandle() : m_index(-1), m_generation(0) { }
+		bool IsNull() const { return m_generation == 0; }
+	};
+
+	/// Issue a handle to pTarget.  The handle must be released with
+	/// ReleaseWeakHandle when it is no longer needed.
+	WeakHandle MakeWeakHandle(ReferenceTarget* pTarget)
+	{
+		WeakHandle handle;
+		if (pTarget == NULL)
+			return handle;
+
+		RareState& rare = GetRareState();
+		if (rare.m_freeWeakHandles.empty())
+		{
+			WeakHandleEntry entry;
+			entry.m_generation = 1;
+			rare.m_freeWeakHandles.push_back(int(rare.m_weakHandles.size()));
+			rare.m_weakHandles.push_back(entry);
+		}
+
+		handle.m_index = rare.m_freeWeakHandles.back();
+		rare.m_freeWeakHandles.pop_back();
+
+		WeakHandleEntry& entry = rare.m_weakHandles[handle.m_index];
+		entry.m_target = pTarget;
+		entry.m_animHandle = Animatable::GetHandleByAnim(pTarget);
+		handle.m_generation = entry.m_generation;
+		return handle;
+	}
+
+	/// Returns the target of handle if it is still alive, else NULL.  O(1).
+	/// NULL is also returned if handle has been released.
+	ReferenceTarget* ResolveWeakHandle(const WeakHandle& handle)
+	{
+		if (handle.IsNull() || m_pRareState == NULL || size_t(handle.m_index) >= m_pRareState->m_weakHandles.size())
+			return NULL;
+
+		const WeakHandleEntry& entry = m_pRareState->m_weakHandles[handle.m_index];
+		if (entry.m_generation != handle.m_generation)
+			return NULL;
+
+		// AnimHandles are never reused, so if 3ds Max still knows ours,
+		// it is the same object we were given.
+		Animatable* pAnim = Animatable::GetAnimByHandle(entry.m_animHandle);
+		if (pAnim == NULL || pAnim != static_cast<Animatable*>(entry.m_target))
+			return NULL;
+		return entry.m_target;
+	}
+
+	/// Returns true if the target of handle is still alive.  O(1).
+	bool IsWeakHandleAlive(const WeakHandle& handle)
+	{
+		return ResolveWeakHandle(handle) != NULL;
+	}
+
+	/// Release a handle issued by MakeWeakHandle.  The handle
+	/// (and every copy of it) will no longer resolve.
+	void ReleaseWeakHandle(WeakHandle& handle)
+	{
+		if (handle.IsNull() || m_pRareState == NULL || size_t(handle.m_index) >= m_pRareState->m_weakHandles.size())
+			return;
+
+		WeakHandleEntry& entry = m_pRareState->m_weakHandles[handle.m_index];
+		DbgAssert(entry.m_generation == handle.m_generation && "ERROR: Weak handle released twice");
+		if (entry.m_generation == handle.m_generation)
+		{
+			entry.m_target = NULL;
+			entry.m_animHandle = 0;
+			// Skip 0 on wrap-around, it marks a NULL handle
+			if (++entry.m_generation == 0)
+				entry.m_generation = 1;
+			m_pRareState->m_freeWeakHandles.push_back(handle.m_index);
+		}
+		handle = WeakHandle();
+	}
+
+#pragma endregion // Weak handles
+
     //========================================================================
 #pragma region // IReferenceManager derived methods
 
@@ -285,7 +1123,7 @@ private:
 	// Get/Set should be only used the template pointer classes
 	RefTargetHandle GetRef(size_t n) { return GetInfo(n)->m_target; }
 	void SetRef(size_t n, ReferenceTarget* pTarget) { 
-		ReplaceReference((int)n, pTarget); 
+		this->ReplaceReference((int)n, pTarget); 
 		// Our only hack - sometimes we will be notified of a target
 		// being deleted. If this happens, the original code was
 		// if (msg == REFMSG_TARGET_DELETED) ptr = NULL;
@@ -313,18 +1151,52 @@ public:
 
     int GetReferenceIndex(ReferenceTarget* ref) 
     {
-        for (int i=0; i < NumRefs(); ++i)
-            if (GetReference(i) == ref)
-                return i;
-        return -1;
+		REFMGR_STAT_ADD(numTargetLookups, 1);
+
+		// Empty slots are not indexed, find the first one the slow way
+		if (ref == NULL)
+		{
+			REFMGR_STAT_ADD(numLinearScans, 1);
+			for (int i=0; i < kBaseIndex; ++i)
+				if (GetReference(i) == ref)
+				{
+					REFMGR_STAT_ADD(linearScanLength, i + 1);
+					return i;
+				}
+			for (size_t pos=0; pos < m_targets.length(); ++pos)
+				if (m_targets[pos] == ref)
+				{
+					REFMGR_STAT_ADD(linearScanLength, kBaseIndex + pos + 1);
+					return int(pos + kBaseIndex);
+				}
+			REFMGR_STAT_ADD(linearScanLength, kBaseIndex + m_targets.length());
+			return -1;
+		}
+
+		// Parent class references are not in our index
+		for (int i=0; i < kBaseIndex; ++i)
+			if (GetReference(i) == ref)
+				return i;
+
+		// Multiple slots may hold the same target, return the lowest
+		int n = -1;
+		for (RefInfo* pInfo = m_targetSlots.Find(ref); pInfo != NULL; pInfo = pInfo->m_pNextSameTarget)
+		{
+			if (n < 0 || pInfo->m_slot < n)
+				n = pInfo->m_slot;
+		}
+		DbgAssert(n < 0 || GetReference(n) == ref);
+		return n;
     }
 
 	int GetReferenceIndex(RefInfo* ref) 
 	{
-		for (int i=0; i < NumRefs(); ++i)
-			if (GetInfo(i) == ref)
-				return i;
-		return -1;
+		if (ref == NULL)
+			return -1;
+
+		// Every live RefInfo knows where it is
+		DbgAssert(GetInfo(ref->m_slot) == ref && "ERROR: RefInfo slot is out of date");
+		return ref->m_slot;
 	}
 
 	int GetBaseReferenceIndex() 
@@ -341,12 +1213,73 @@ public:
 		return dynamic_cast<T>(GetReference(n));
 	}
 
+#ifdef REFMGR_ENABLE_STATS
+	/// Returns how many messages of the given type have been passed to reference callbacks.
+	/// If filtered is true, instead returns how many were skipped by the callbacks message filters.
+	/// The dispatch counts are instrumentation, so are only kept with REFMGR_ENABLE_STATS.
+	DWORD GetMessageDispatchCount(RefMessageType msgType, bool filtered = false) const
+	{
+		DbgAssert(msgType >= 0 && msgType < kNumRefMsgTypes);
+		return DWORD(filtered ? m_stats.numFiltered[msgType] : m_stats.numCallbacks[msgType]);
+	}
+
+	/// Returns how many messages have been passed to the callback of reference i
+	/// If filtered is true, instead returns how many were skipped by its message filter.
+	/// Use this to find which references are noisy.
+	DWORD GetReferenceDispatchCount(int i, bool filtered = false)
+	{
+		RefInfo* pInfo = GetInfo(i);
+		if (pInfo == NULL)
+			return 0;
+		return filtered ? pInfo->m_numFiltered : pInfo->m_numDispatched;
+	}
+#endif
+
+	/// Returns the occupancy of the pool our RefInfo records are allocated from.
+	/// numLive is the number of references currently registered.
+	SlabPoolStats GetRefInfoPoolStats() const { return m_infoPool.GetStats(); }
+
+#ifdef REFMGR_ENABLE_STATS
+	/// Returns this instances counters.  See RefMgrGlobalStats for every instance.
+	const RefMgrStats& GetStats() const { return m_stats; }
+
+	/// Returns our counters as JSON, along with the dispatch counts of every
+	/// reference that has been sent a message, to find the hot ones.
+	/// {"stats":{...},"references":[{"index":i,"dispatched":n,"filtered":m},...]}
+	std::string GetStatsJson()
+	{
+		std::ostringstream json;
+		json << "{\"stats\":" << m_stats.ToJson() << ",\"references\":[";
+		bool first = true;
+		for (size_t pos = 0; pos < m_refs.length(); pos++)
+		{
+			RefInfo* pInfo = m_refs[pos];
+			if (pInfo == NULL || (pInfo->m_numDispatched == 0 && pInfo->m_numFiltered == 0))
+				continue;
+			json << (first ? "" : ",")
+				<< "{\"index\":" << (pos + kBaseIndex)
+				<< ",\"dispatched\":" << pInfo->m_numDispatched
+				<< ",\"filtered\":" << pInfo->m_numFiltered << "}";
+			first = false;
+		}
+		json << "]}";
+		return json.str();
+	}
+#endif
+
 	RefInfo* GetInfo(size_t refId) { 
 		if (refId >= kBaseIndex && refId < m_refs.length() + kBaseIndex) 
 			return m_refs[refId - kBaseIndex]; 
 		return NULL;
 	}
 
+	// Returns the kSlotFlags for reference refId
+	BYTE GetSlotFlags(size_t refId) {
+		if (refId >= kBaseIndex && refId < m_slotFlags.length() + kBaseIndex) 
+			return m_slotFlags[refId - kBaseIndex]; 
+		return 0;
+	}
+
 #pragma endregion // IReferenceManager derived methods
 
 	//========================================================================
@@ -360,50 +1293,49 @@ protected:
     // Important Note: do not call RegisterReference after construction. All fully constructed 
     // instances of a plug-in must have the same number of references if they want to 
     // use ReferenceManager. Returning REF_FAIL most likely indicates a circular reference. 
-    RefResult RegisterReference(size_t n, NotifyCallback* callback, ReferenceTarget* ref, bool isWeak = false, bool isPersisted = true) 
+    RefResult RegisterReference(size_t n, NotifyCallback* callback, ReferenceTarget* ref, bool isWeak = false, bool isPersisted = true, DWORD messageFilter = kRefMsgFilterAll) 
     {
 		DbgAssert(!IsValidReferenceIndex(int(n)) && "Cannot register reference to a live index");
 		
 		// Add a new RefInfo structure to the array.
-		InsertReference(int(n), callback, isWeak, isPersisted);
+		InsertReference(int(n), callback, isWeak, isPersisted, messageFilter);
 		
 		// We have to call ReplaceReference to set the reference so that 3ds Max can 
         // track the reference correctly. This will also check that result is not a circular reference
-        RefResult result = ReplaceReference(int(n), ref);
+        RefResult result = this->ReplaceReference(int(n), ref);
         
         return result;           
     }  
 
 	bool RegisterReferenceArray(size_t arrayIdx)
 	{
-		// Ensure that arrayIdx is within range of m_refs
-		//int arrayRefIdx = GetReferenceIndexForArray(arrayIdx);
-		if (arrayIdx >= m_refs.length())
+		SnapshotUpdate snapshotUpdate(*this);
+		// Arrays declared in our layout were registered on construction
+		if (Layout_T::IsArray(arrayIdx))
 		{
-			if (arrayIdx > m_baseDynIdx)
-			{
-				// If we have arrays below us, we no longer
-				// can assume that arrayIdx == our refIdx;
-				// Calculate what it should be...
-				size_t nArrays = m_arraySizes.size();
-				if ((size_t)nArrays < arrayIdx)
-				{
-					// How refs do we have currently?
-					size_t nRefs = m_refs.length();
-					size_t nNewRefs = 1 + arrayIdx - (m_baseDynIdx + m_arraySizes.size());
-					// If the above tries to go negative, our unsigned size_t
-					// becomes a Very Large Number
-					DbgAssert(nNewRefs < INT_MAX);
-					if (nNewRefs < INT_MAX)
-						m_refs.setLengthUsed(nRefs + nNewRefs, NULL);
-				}
-			}
-			else if (m_arraySizes.size() == 0)
+			DbgAssert(m_arraySizes[arrayIdx - m_baseDynIdx] == 0 && "ERROR: Array registered twice");
+			return true;
+		}
+
+		// Ensure that arrayIdx has a slot in m_refs
+		if (arrayIdx >= m_baseDynIdx)
+		{
+			// If we have arrays below us, we no longer
+			// can assume that arrayIdx == our refIdx.
+			// Each id from m_baseDynIdx up has an entry in m_arraySizes,
+			// and the slots of ids without one yet go on the end.
+			size_t nArrays = m_arraySizes.size();
+			if (nArrays <= arrayIdx - m_baseDynIdx)
 			{
-				size_t nNewLength = arrayIdx + 1;
-				m_refs.setLengthUsed(nNewLength, NULL);
+				size_t nNewRefs = 1 + (arrayIdx - m_baseDynIdx) - nArrays;
+				GrowSlots(m_refs.length() + nNewRefs);
 			}
 		}
+		else if (arrayIdx >= m_refs.length())
+		{
+			// Below m_baseDynIdx, ids are slot indices
+			GrowSlots(arrayIdx + 1);
+		}
 
 		// Ensure that we record the lowest-indexed
 		// array created (this is so that refs that are
@@ -418,12 +1350,8 @@ protected:
 			DbgAssert(numToConvert < INT_MAX);
 
 			// Now, convert numToConvert previously static references to dynamic ones
-			size_t *dNewIndices = new size_t[numToConvert];
 			// init following indices to 1 (thats the size of the array they represent)
-			for (size_t i = 0; i < numToConvert; i++)
-				dNewIndices[i] = 1;
-			m_arraySizes.insert(m_arraySizes.begin(), dNewIndices, dNewIndices + numToConvert);
-			delete dNewIndices;
+			m_arraySizes.Insert(0, numToConvert, 1);
 			// Our array index is the new lowest dynamic index
 			m_baseDynIdx = int(arrayIdx);
 		}
@@ -437,12 +1365,8 @@ protected:
 			if ((int)numArrays > m_arraySizes.size())
 			{
 				size_t numToConvert = numArrays - m_arraySizes.size();
-				size_t *dNewIndices = new size_t[numToConvert];
 				// init new indices to 1 (thats the size of the array they represent)
-				for (size_t i = 0; i < numToConvert; i++)
-					dNewIndices[i] = 1;
-				m_arraySizes.insert(m_arraySizes.end(), dNewIndices, dNewIndices + numToConvert);
-				delete [] dNewIndices;
+				m_arraySizes.Append(numToConvert, 1);
 			}
 		}
 
@@ -470,14 +1394,16 @@ protected:
 		// has a size of 0.  To do this, we remove the NULL
 		// RefPtr currently at this index - NOTE: This will
 		// decrease the index of all the higher RefPtrs by 1
-		m_refs.removeAt(nRefIdxForArray);
-		m_arraySizes[arrayIdx] = 0;
+		if (!RemoveSlots(nRefIdxForArray - kBaseIndex, 1))
+			return false;
+		m_arraySizes.Set(arrayIdx, 0);
 		return true;
 	}
 
 	// Dynamic array sizes.  Only accessible from ReferenceManager
 	RefResult ReleaseReference(RefInfo* pInfo)
 	{
+		SnapshotUpdate snapshotUpdate(*this);
 		DbgAssert(pInfo != NULL);
 
 		// Find our target
@@ -490,56 +1416,55 @@ protected:
 		DbgAssert(pInfo == GetInfo(n));
 		
 		// Very important - this reference has now gone away!
-		if (pInfo->m_target != NULL)
+		ReferenceTarget* pOldTarget = pInfo->m_target;
+		if (pOldTarget != NULL)
 		{
-			DeleteReference(n);
+			this->DeleteReference(n);
 			DbgAssert(pInfo->m_target == NULL);
+			// Should have been done by SetReference, but never leave a dangling slot in the index
+			UnindexTarget(pOldTarget, pInfo);
 		}
 
 		// resize the actual array
 		// Only resize the array if the ref info is dynamic
 		bool bResizeArray = ((size_t) n >= m_baseDynIdx);
-		if (bResizeArray)
-		{
-#ifdef _DEBUG
-			bool res = 
-#endif
-				m_refs.remove(pInfo);
-			DbgAssert(res == true);
-		}
-		else
-			m_refs[m_refs.find(pInfo)] = NULL;
+		if (!bResizeArray)
+			ClearSlot(n - kBaseIndex);
+		else if (!RemoveSlots(n - kBaseIndex, 1))
+			return REF_FAIL;
+		pInfo->m_slot = -1;
+		CancelPendingNotification(pInfo);
 		
 		// References cleaned up.  Delete the info
-		delete pInfo;
+		FreeInfo(pInfo);
 		// Success!
 		return REF_SUCCEED;
 	}
 
-	RefInfo* InsertReference(int n, NotifyCallback* callback, bool isWeak = false, bool isPersisted = true) 
+	RefInfo* InsertReference(int n, NotifyCallback* callback, bool isWeak = false, bool isPersisted = true, DWORD messageFilter = kRefMsgFilterAll) 
     {
 		// -ve number means just the last one.
 		if (n < 0)
 			n = NumRefs();
 
 		// Add a new RefInfo structure to the array.
-		while (n >= NumRefs())
-			m_refs.append(NULL);
+		if (n >= NumRefs())
+			GrowSlots(n - kBaseIndex + 1);
 
 		// Ensure we insert at the appropriate index!
 		// Watch out - as m_refs.length() doesnt necessarily == NumRefs
-		if (GetInfo(n) != NULL)
-			m_refs.insertAt(n-kBaseIndex, NULL);
+		if (GetInfo(n) != NULL && !InsertSlots(n - kBaseIndex, 1))
+			return NULL;
 
 		// Validate this all
 		DbgAssert(GetInfo(n) == NULL);
 
 		// Create the reference object
-		RefInfo* newInfo = new RefInfo();
-		newInfo->SetIsWeak(isWeak);
-		newInfo->SetIsPersisted(isPersisted);
+		RefInfo* newInfo = NewInfo();
 		newInfo->m_callback = callback;
-		m_refs[n-kBaseIndex] = newInfo;
+		newInfo->m_messageFilter = messageFilter;
+		newInfo->m_slot = n;
+		SetSlot(n - kBaseIndex, newInfo, isWeak, isPersisted);
 
 		// This is almost like unit testing
 		DbgAssert(GetInfo(n) == newInfo);
@@ -549,8 +1474,9 @@ protected:
 		return newInfo;           
     }   
 
-	RefInfo* RegisterReference(size_t arrayIdx, int index, NotifyCallback* callback, ReferenceTarget* ref=NULL, bool isWeak = false, bool isPersisted = true)
+	RefInfo* RegisterReference(size_t arrayIdx, int index, NotifyCallback* callback, ReferenceTarget* ref=NULL, bool isWeak = false, bool isPersisted = true, DWORD messageFilter = kRefMsgFilterAll)
 	{
+		SnapshotUpdate snapshotUpdate(*this);
 		// If we are a static index ref, it is because
 		// there are no dynamic refs lower than us
 		if (arrayIdx < m_baseDynIdx)
@@ -559,7 +1485,7 @@ protected:
 			DbgAssert(index == 0 && "ERROR: Trying to assign an array reference to a static index");
 			// Register a bog-standard static-idx ref
 			DbgAssert(GetInfo(arrayIdx) == NULL && "ERROR: Trying to assign to existing slot");
-			RefResult res = RegisterReference(arrayIdx, callback, ref, isWeak, isPersisted);
+			RefResult res = RegisterReference(arrayIdx, callback, ref, isWeak, isPersisted, messageFilter);
 			res;
 			DbgAssert(res == REF_SUCCEED);
 			return GetInfo(arrayIdx);
@@ -572,10 +1498,7 @@ protected:
 		// We automatically account for any new arrays without requiring registration of the array itself
 		if (arrayIdx >= (size_t)m_arraySizes.size())
 		{
-			size_t oldCount = m_arraySizes.size();
-			m_arraySizes.resize(arrayIdx + 1);
-			for (size_t i = oldCount; i <= arrayIdx; i++)
-				m_arraySizes[i] = 1;
+			m_arraySizes.Append(arrayIdx + 1 - m_arraySizes.size(), 1);
 		}
 		else
 		{
@@ -591,22 +1514,128 @@ protected:
 		// Find the reference index for this array and offset
 		size_t n = GetReferenceIndexForArray(arrayIdx, index);
 		// Create the reference at this index
-		RefInfo* pInfo = InsertReference(int(n), callback, isWeak, isPersisted);
+		RefInfo* pInfo = InsertReference(int(n), callback, isWeak, isPersisted, messageFilter);
 		DbgAssert(pInfo != NULL && pInfo == GetInfo(n) && "ERROR: Inserted reference doesn't match specified index");
 		if (pInfo == NULL) 
 			return pInfo;
 
 		// Assign ref
 		if (ref != NULL)
-			ReplaceReference(int(n), ref);
+			this->ReplaceReference(int(n), ref);
 		DbgAssert(GetReference(int(n)) == ref);
 
 		return pInfo;
 	}
 
+	bool RegisterReferences(size_t arrayIdx, int index, int count, const NotifyCallback* callback, RefInfo** outInfos, bool isWeak = false, bool isPersisted = true, DWORD messageFilter = kRefMsgFilterAll, const ArrayNotifyCallback* sharedCallback = NULL)
+	{
+		SnapshotUpdate snapshotUpdate(*this);
+		DbgAssert(count >= 0);
+		if (count <= 0)
+			return true;
+
+		// Bulk registration only makes sense for arrays
+		DbgAssert(arrayIdx >= m_baseDynIdx && "ERROR: Trying to register multiple references on a static index");
+		if (arrayIdx < m_baseDynIdx)
+			return false;
+
+		arrayIdx -= m_baseDynIdx;
+		DbgAssert(arrayIdx < m_arraySizes.size() && "ERROR: Array has not been registered");
+		if (arrayIdx >= m_arraySizes.size())
+			return false;
+
+		// index == the index in this array. -1 means at the end of the array
+		size_t oldSize = m_arraySizes[arrayIdx];
+		if (index < 0)
+			index = int(oldSize);
+		DbgAssert(size_t(index) <= oldSize);
+
+		// Open up count empty slots with a single shift of everything above us
+		size_t n = GetReferenceIndexForArray(arrayIdx, index);
+		size_t first = n - kBaseIndex;
+		if (!InsertSlots(first, count))
+			return false;
+
+		// Fill the new slots
+		ReserveInfos(count);
+		for (int i = 0; i < count; i++)
+		{
+			RefInfo* newInfo = NewInfo();
+			if (sharedCallback != NULL)
+				newInfo->m_arrayCallback = sharedCallback;
+			else if (callback != NULL)
+				newInfo->m_callback = new NotifyCallback(*callback);
+			newInfo->m_messageFilter = messageFilter;
+			newInfo->m_slot = int(n + i);
+			SetSlot(first + i, newInfo, isWeak, isPersisted);
+			outInfos[i] = newInfo;
+		}
+
+		m_arraySizes.Add(arrayIdx, count);
+		ValidateArrays();
+
+		DbgAssert((isWeak || isPersisted == TRUE) && "Strong references are always persisted automatically");
+		return true;
+	}
+
+	ReferenceTarget* const* GetArrayTargets(size_t arrayIdx, int& count)
+	{
+		count = 0;
+		DbgAssert(arrayIdx >= m_baseDynIdx && "ERROR: Requesting the targets of a static index");
+		if (arrayIdx < m_baseDynIdx)
+			return NULL;
+
+		arrayIdx -= m_baseDynIdx;
+		DbgAssert(arrayIdx < m_arraySizes.size() && "ERROR: Array has not been registered");
+		if (arrayIdx >= m_arraySizes.size() || m_arraySizes[arrayIdx] == 0)
+			return NULL;
+
+		count = int(m_arraySizes[arrayIdx]);
+		return m_targets.asArrayPtr() + (GetReferenceIndexForArray(arrayIdx, 0) - kBaseIndex);
+	}
+
+	bool PermuteReferences(size_t arrayIdx, int index, int count, const int* pOrder)
+	{
+		SnapshotUpdate snapshotUpdate(*this);
+		if (count <= 1)
+			return true;
+
+		// Only array references can be reordered
+		DbgAssert(arrayIdx >= m_baseDynIdx && "ERROR: Trying to reorder references on a static index");
+		if (arrayIdx < m_baseDynIdx)
+			return false;
+
+		arrayIdx -= m_baseDynIdx;
+		DbgAssert(arrayIdx < m_arraySizes.size() && "ERROR: Array has not been registered");
+		if (arrayIdx >= m_arraySizes.size())
+			return false;
+
+		DbgAssert(index >= 0 && size_t(index + count) <= m_arraySizes[arrayIdx]);
+		if (index < 0 || size_t(index + count) > m_arraySizes[arrayIdx])
+			return false;
+
+		// Copy out the range, and write it back in the new order
+		MarkSnapshotDirty();
+		size_t first = GetReferenceIndexForArray(arrayIdx, index) - kBaseIndex;
+		std::vector<ReferenceTarget*> targets(m_targets.asArrayPtr() + first, m_targets.asArrayPtr() + first + count);
+		std::vector<BYTE> flags(m_slotFlags.asArrayPtr() + first, m_slotFlags.asArrayPtr() + first + count);
+		std::vector<RefInfo*> refs(m_refs.asArrayPtr() + first, m_refs.asArrayPtr() + first + count);
+		for (int i = 0; i < count; i++)
+		{
+			int from = pOrder[i];
+			DbgAssert(from >= 0 && from < count);
+			m_targets[first + i] = targets[from];
+			m_slotFlags[first + i] = flags[from];
+			m_refs[first + i] = refs[from];
+			refs[from]->m_slot = int(first + i + kBaseIndex);
+		}
+		return true;
+	}
+
 	// Dynamic array sizes.  Only accessible from RefPtr
 	RefResult ReleaseReference(RefInfo* pInfo, size_t arrayIdx)
 	{
+		SnapshotUpdate snapshotUpdate(*this);
 #ifdef _DEBUG
 		// Find our target
 		size_t refIdx = GetReferenceIndex(pInfo);
@@ -654,6 +1683,122 @@ protected:
 		return REF_SUCCEED;
 	}
 
+	RefResult ReleaseReferences(RefInfo** ppInfos, int count, size_t arrayIdx)
+	{
+		SnapshotUpdate snapshotUpdate(*this);
+		DbgAssert(count >= 0);
+		if (count <= 0)
+			return REF_SUCCEED;
+
+		// Bulk release only makes sense for arrays
+		DbgAssert(arrayIdx >= m_baseDynIdx && "ERROR: Trying to release multiple references on a static index");
+		if (arrayIdx < m_baseDynIdx)
+			return REF_FAIL;
+
+		arrayIdx -= m_baseDynIdx;
+#ifdef _DEBUG
+		size_t arrayStart = GetReferenceIndexForArray(arrayIdx, 0);
+		size_t arrayEnd = arrayStart + m_arraySizes[arrayIdx];
+#endif
+
+		// Very important - these references have now gone away!
+		size_t firstPos = m_refs.length();
+		for (int i = 0; i < count; i++)
+		{
+			RefInfo* pInfo = ppInfos[i];
+			int n = pInfo->m_slot;
+#ifdef _DEBUG
+			DbgAssert(size_t(n) >= arrayStart && size_t(n) < arrayEnd && "ERROR: Released references are not all in the right array");
+#endif
+			ReferenceTarget* pOldTarget = pInfo->m_target;
+			if (pOldTarget != NULL)
+			{
+				this->DeleteReference(n);
+				DbgAssert(pInfo->m_target == NULL);
+				UnindexTarget(pOldTarget, pInfo);
+			}
+
+			size_t pos = n - kBaseIndex;
+			DbgAssert((m_slotFlags[pos] & kSlotReleased) == 0 && "ERROR: Reference released twice");
+			m_slotFlags[pos] |= kSlotReleased;
+			if (pos < firstPos)
+				firstPos = pos;
+		}
+
+		// Nothing can call back in to us now.  Delete the infos,
+		// and close up all the gaps in one go.
+		if (m_pRareState != NULL)
+		{
+			std::vector<RefInfo*>& pendingNotifies = m_pRareState->m_pendingNotifies;
+			for (size_t i = 0; i < pendingNotifies.size(); i++)
+			{
+				RefInfo* pInfo = pendingNotifies[i];
+				if (pInfo != NULL && (m_slotFlags[pInfo->m_slot - kBaseIndex] & kSlotReleased) != 0)
+				{
+					pInfo->ClearFlag(RefInfo::kIsPending);
+					pendingNotifies[i] = NULL;
+				}
+			}
+		}
+		for (int i = 0; i < count; i++)
+			FreeInfo(ppInfos[i]);
+		RemoveReleasedSlots(firstPos);
+
+		m_arraySizes.Add(arrayIdx, -count);
+		ValidateArrays();
+		return REF_SUCCEED;
+	}
+
+	RefResult ReleaseReferences(RefInfo* pFirst, int count, size_t arrayIdx)
+	{
+		SnapshotUpdate snapshotUpdate(*this);
+		DbgAssert(count >= 0);
+		if (count <= 0)
+			return REF_SUCCEED;
+
+		int n = GetReferenceIndex(pFirst);
+		DbgAssert(n >= 0);
+		if (n < 0)
+			return REF_FAIL;
+
+		// Bulk release only makes sense for arrays
+		DbgAssert(arrayIdx >= m_baseDynIdx && size_t(n) >= m_baseDynIdx && "ERROR: Trying to release multiple references on a static index");
+		if (arrayIdx < m_baseDynIdx || size_t(n) < m_baseDynIdx)
+			return REF_FAIL;
+
+		arrayIdx -= m_baseDynIdx;
+#ifdef _DEBUG
+		size_t arrayStart = GetReferenceIndexForArray(arrayIdx, 0);
+		DbgAssert(size_t(n) >= arrayStart && size_t(n + count) <= arrayStart + m_arraySizes[arrayIdx] && "ERROR: Released references are not all in the right array");
+#endif
+
+		// Very important - these references have now gone away!
+		for (int i = n; i < n + count; i++)
+		{
+			RefInfo* pInfo = GetInfo(i);
+			ReferenceTarget* pOldTarget = pInfo->m_target;
+			if (pOldTarget != NULL)
+			{
+				this->DeleteReference(i);
+				DbgAssert(pInfo->m_target == NULL);
+				UnindexTarget(pOldTarget, pInfo);
+			}
+		}
+
+		// Nothing can call back in to us now.  Delete the infos, 
+		// and close up the gap in one go.
+		size_t first = n - kBaseIndex;
+		CancelPendingNotifications(n, count);
+		for (int i = 0; i < count; i++)
+			FreeInfo(m_refs[first + i]);
+		if (!RemoveSlots(first, count))
+			return REF_FAIL;
+
+		m_arraySizes.Add(arrayIdx, -count);
+		ValidateArrays();
+		return REF_SUCCEED;
+	}
+
 	// Set the callback for the specified reference
 	// This allows derived classes to override the parents
 	// callback if necessary.  This function will take
@@ -671,6 +1816,8 @@ protected:
 		// If any callback existed prior, delete it.
 		delete pInfo->m_callback;
 		pInfo->m_callback = pCallback;
+		// An explicit callback replaces the arrays shared one
+		pInfo->m_arrayCallback = NULL;
 		return true;
 	}
 
@@ -682,7 +1829,7 @@ protected:
 	// maintain a pointer to the callback
 	bool SetNotifyCallback(ReferenceTarget* target, NotifyCallback* pCallback)
 	{
-		return SetNotifyCallback(FindRef(target), pCallback);
+		return SetNotifyCallback(GetReferenceIndex(target), pCallback);
 	}
 
 	/// Private, local functions
@@ -694,11 +1841,14 @@ protected:
 			return -1;
 
 		// Count the total up till whereever we are
-		size_t total = m_baseDynIdx;
+		size_t total = m_baseDynIdx + m_arraySizes.PrefixSum(arrayIdx);
+#ifdef _DEBUG
+		// Cross-check the tree against a plain sum of the sizes
+		size_t linearTotal = m_baseDynIdx;
 		for (size_t i = 0; i < arrayIdx; i++)
-		{
-			total += m_arraySizes[i];
-		}
+			linearTotal += m_arraySizes[i];
+		DbgAssert(total == linearTotal && "ERROR: Array size tree is out of sync");
+#endif
 
 		// Is our offset in range?
 		//if (offset < 0)
@@ -714,7 +1864,7 @@ protected:
 	{
 		DbgAssert(arrayIdx >= 0 && arrayIdx < m_arraySizes.size());
 		if (arrayIdx >= 0 && arrayIdx < m_arraySizes.size())
-			m_arraySizes[arrayIdx]++;
+			m_arraySizes.Add(arrayIdx, 1);
 
 		// Debugging
 		ValidateArrays();
@@ -724,12 +1874,197 @@ protected:
 	{
 		DbgAssert(arrayIdx >= 0 && arrayIdx < m_arraySizes.size());
 		if (arrayIdx >= 0 && arrayIdx < m_arraySizes.size())
-			m_arraySizes[arrayIdx]--;
+			m_arraySizes.Add(arrayIdx, -1);
 
 		// Debugging
 		ValidateArrays();
 	}
 
+	// Returns m_pRareState, allocating it if required
+	RareState& GetRareState()
+	{
+		if (m_pRareState == NULL)
+			m_pRareState = new RareState();
+		return *m_pRareState;
+	}
+
+	// Allocate a RefInfo
+	RefInfo* NewInfo()
+	{
+		REFMGR_STAT_ADD(numInfoAllocs, 1);
+		return m_infoPool.New();
+	}
+
+	// Ensure the next count calls to NewInfo allocate at most one slab
+	void ReserveInfos(size_t count)
+	{
+		m_infoPool.Reserve(count);
+	}
+
+	// Release a RefInfo allocated by NewInfo
+	void FreeInfo(RefInfo* pInfo)
+	{
+		REFMGR_STAT_ADD(numInfoFrees, 1);
+		ClearDirty(pInfo);
+
+		// Don't let NotifyTargetDeleted call a released reference
+		for (DeletedTargetDispatch* pDispatch = m_pDeletedDispatch; pDispatch != NULL; pDispatch = pDispatch->m_pOuter)
+		{
+			for (size_t i = 0; i < pDispatch->m_infos.size(); i++)
+				if (pDispatch->m_infos[i] == pInfo)
+					pDispatch->m_infos[i] = NULL;
+		}
+
+		m_infoPool.Delete(pInfo);
+	}
+
+	// Record that pInfo now references target
+	void IndexTarget(ReferenceTarget* target, RefInfo* pInfo)
+	{
+		if (target != NULL)
+			m_targetSlots.Insert(target, pInfo);
+	}
+
+	// Remove the record of pInfo referencing target
+	void UnindexTarget(ReferenceTarget* target, RefInfo* pInfo)
+	{
+		if (target != NULL)
+			m_targetSlots.Remove(target, pInfo);
+	}
+
+	//------------------------------------------------------------------------
+	// Slot table functions.  These take positions in the slot table, 
+	// ie (reference index - kBaseIndex).
+
+	// Extend the slot table to length slots.  The new slots are empty.
+	void GrowSlots(size_t length)
+	{
+		if (length <= m_refs.length())
+			return;
+		MarkSnapshotDirty();
+		m_targets.setLengthUsed(length, NULL);
+		m_slotFlags.setLengthUsed(length, 0);
+		m_refs.setLengthUsed(length, NULL);
+	}
+
+	// Open count empty slots at pos, with a single shift of everything above.
+	// Returns false (changing nothing) if pos is past the end of the table.
+	bool InsertSlots(size_t pos, size_t count)
+	{
+		size_t oldLength = m_refs.length();
+		DbgAssert(pos <= oldLength && "ERROR: Inserting slots past the end of the slot table");
+		if (pos > oldLength)
+			return false;
+		GrowSlots(oldLength + count);
+
+		size_t numToMove = oldLength - pos;
+		if (numToMove == 0)
+			return true;
+		MarkSnapshotDirty();
+
+		ReferenceTarget** pTargets = m_targets.asArrayPtr();
+		BYTE* pFlags = m_slotFlags.asArrayPtr();
+		RefInfo** pRefs = m_refs.asArrayPtr();
+		memmove(pTargets + pos + count, pTargets + pos, numToMove * sizeof(ReferenceTarget*));
+		memmove(pFlags + pos + count, pFlags + pos, numToMove * sizeof(BYTE));
+		memmove(pRefs + pos + count, pRefs + pos, numToMove * sizeof(RefInfo*));
+		memset(pTargets + pos, 0, count * sizeof(ReferenceTarget*));
+		memset(pFlags + pos, 0, count * sizeof(BYTE));
+		memset(pRefs + pos, 0, count * sizeof(RefInfo*));
+
+		// Everything above us has moved up count
+		RenumberSlots(pos + count);
+		return true;
+	}
+
+	// Remove the count slots at pos, with a single shift of everything above.
+	// The slots must no longer be referenced by any RefInfo.
+	// Returns false (changing nothing) if the range is not inside the table.
+	bool RemoveSlots(size_t pos, size_t count)
+	{
+		size_t oldLength = m_refs.length();
+		DbgAssert(pos <= oldLength && count <= oldLength - pos && "ERROR: Removing slots past the end of the slot table");
+		if (pos > oldLength || count > oldLength - pos)
+			return false;
+		MarkSnapshotDirty();
+
+		size_t numToMove = oldLength - pos - count;
+		if (numToMove > 0)
+		{
+			ReferenceTarget** pTargets = m_targets.asArrayPtr();
+			BYTE* pFlags = m_slotFlags.asArrayPtr();
+			RefInfo** pRefs = m_refs.asArrayPtr();
+			memmove(pTargets + pos, pTargets + pos + count, numToMove * sizeof(ReferenceTarget*));
+			memmove(pFlags + pos, pFlags + pos + count, numToMove * sizeof(BYTE));
+			memmove(pRefs + pos, pRefs + pos + count, numToMove * sizeof(RefInfo*));
+		}
+		m_targets.setLengthUsed(oldLength - count);
+		m_slotFlags.setLengthUsed(oldLength - count);
+		m_refs.setLengthUsed(oldLength - count);
+
+		// Everything above us has moved down count
+		RenumberSlots(pos);
+		return true;
+	}
+
+	// Remove every slot at or above pos marked kSlotReleased, 
+	// moving the survivors down in a single pass.
+	void RemoveReleasedSlots(size_t pos)
+	{
+		MarkSnapshotDirty();
+		size_t oldLength = m_refs.length();
+		size_t dst = pos;
+		for (size_t src = pos; src < oldLength; src++)
+		{
+			if (m_slotFlags[src] & kSlotReleased)
+				continue;
+			if (dst != src)
+			{
+				m_targets[dst] = m_targets[src];
+				m_slotFlags[dst] = m_slotFlags[src];
+				m_refs[dst] = m_refs[src];
+			}
+			dst++;
+		}
+		m_targets.setLengthUsed(dst);
+		m_slotFlags.setLengthUsed(dst);
+		m_refs.setLengthUsed(dst);
+
+		// Everything above the first gap has moved down
+		RenumberSlots(pos);
+	}
+
+	// Put pInfo in the (empty) slot at pos
+	void SetSlot(size_t pos, RefInfo* pInfo, bool isWeak, bool isPersisted)
+	{
+		DbgAssert(m_refs[pos] == NULL);
+		MarkSnapshotDirty();
+		m_refs[pos] = pInfo;
+		m_targets[pos] = pInfo->m_target;
+		m_slotFlags[pos] = BYTE(kSlotUsed | (isWeak ? kSlotWeak : 0) | (isPersisted ? kSlotPersisted : 0));
+	}
+
+	// Empty the slot at pos, without moving anything
+	void ClearSlot(size_t pos)
+	{
+		MarkSnapshotDirty();
+		m_refs[pos] = NULL;
+		m_targets[pos] = NULL;
+		m_slotFlags[pos] = 0;
+	}
+
+	// Call this whenever the slot table is shifted.  Every RefInfo at or 
+	// above pos has its m_slot reset to its current position.
+	// This is no more expensive than the shift that made it necessary.
+	void RenumberSlots(size_t pos)
+	{
+		for (size_t i = pos; i < m_refs.length(); i++)
+		{
+			if (m_refs[i] != NULL)
+				m_refs[i]->m_slot = int(i + kBaseIndex);
+		}
+	}
+
 	void ValidateArrays() {
 #ifdef DEBUG
 		// Required if we have arrays
@@ -737,9 +2072,7 @@ protected:
 			return;
 
 		// Sanity checking only.
-		size_t total = m_baseDynIdx;
-		for (int i = 0; i < m_arraySizes.size(); i++)
-			total += m_arraySizes.size();
+		size_t total = m_baseDynIdx + m_arraySizes.PrefixSum(m_arraySizes.size());
 		DbgAssert(total == NumRefs());
 #endif
 	}
@@ -0,0 +1,193 @@
+//
+// Copyright 2009 Autodesk, Inc.  All rights reserved.
+//
+// Use of this software is subject to the terms of the Autodesk license
+// agreement provided at the time of installation or download, or which
+// otherwise accompanies this software in either electronic or hard copy form.
+//
+
+#pragma once
+
+#include <assert1.h>
+#include <new>
+#include <type_traits>
+
+/// Occupancy counters for a SlabPool
+struct SlabPoolStats
+{
+	size_t numSlabs;	// How many slabs have been allocated from the heap
+	size_t capacity;	// The total number of items all slabs can hold
+	size_t numLive;		// How many items are currently in use
+	size_t numFree;		// How many items are available for reuse (capacity - numLive)
+	size_t peakLive;	// The highest numLive has been
+	size_t totalAllocs;	// The number of items ever handed out
+	size_t totalFrees;	// The number of items ever returned
+};
+
+//=========================================================
+/// A simple pool allocator for fixed-size records.
+///
+/// Items are carved from slabs allocated from the heap, and
+/// returned items are kept on a free list to be reused.  Both
+/// New and Delete are O(1).
+///
+/// The pool never shrinks: a slab is not returned to the heap
+/// when its items are all deleted, only when the pool itself is
+/// destroyed.  So the memory held is set by the most items ever
+/// live at once (see SlabPoolStats::peakLive), not by how many
+/// are live now.  Returning empty slabs would need a count per
+/// slab and a search for the slab of each deleted item, which
+/// Delete avoids.  Every item must be returned before the pool
+/// is destroyed.
+///
+/// Each slab holds as many items as all the slabs before it (from
+/// MIN_SLAB_SIZE up to MAX_SLAB_SIZE items), so a pool that only
+/// ever holds a couple of items stays small, while a large pool
+/// needs few slabs.  When the number of items needed is known up
+/// front, Reserve sizes the next slab to fit them.
+///
+/// This class is not thread-safe.
+template<typename T, size_t MIN_SLAB_SIZE = 8, size_t MAX_SLAB_SIZE = 1024>
+class SlabPool
+{
+private:
+	typedef typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type Storage;
+
+	// Returned items are reused to store the free list
+	struct FreeItem { FreeItem* m_next; };
+	static_assert(sizeof(T) >= sizeof(FreeItem), "SlabPool items must be able to hold a pointer");
+
+	// Slab items follow the header in the same allocation
+	struct Slab
+	{
+		Slab* m_next;
+		size_t m_size;
+	};
+
+	Slab* m_slabs;			// Every slab allocated, newest first
+	FreeItem* m_free;		// Items available for reuse
+	// Only these counters are stored, the rest of SlabPoolStats is derived from them
+	size_t m_capacity;
+	size_t m_numLive;
+	size_t m_peakLive;
+	size_t m_totalAllocs;
+
+	// disable copy
+	SlabPool(const SlabPool&);
+	SlabPool& operator=(const SlabPool&);
+
+	// The size of the next slab New allocates: as many items as all
+	// the slabs before it, so the capacity doubles
+	size_t NextSlabSize() const
+	{
+		if (m_capacity < MIN_SLAB_SIZE)
+			return MIN_SLAB_SIZE;
+		return (m_capacity < MAX_SLAB_SIZE) ? m_capacity : MAX_SLAB_SIZE;
+	}
+
+	void AllocateSlab(size_t nItems)
+	{
+		// One allocation, with the header padded up to the item alignment
+		size_t headerSize = (sizeof(Slab) + sizeof(Storage) - 1) / sizeof(Storage);
+		Storage* pMem = new Storage[headerSize + nItems];
+		Slab* pSlab = reinterpret_cast<Slab*>(pMem);
+		pSlab->m_next = m_slabs;
+		pSlab->m_size = nItems;
+		m_slabs = pSlab;
+
+		// Put the new items on the free list, so the first is handed out first
+		Storage* pItems = pMem + headerSize;
+		for (size_t i = nItems; i > 0; --i)
+		{
+			FreeItem* pItem = reinterpret_cast<FreeItem*>(&pItems[i - 1]);
+			pItem->m_next = m_free;
+			m_free = pItem;
+		}
+
+		m_capacity += nItems;
+	}
+
+public:
+
+	SlabPool()
+		: m_slabs(NULL)
+		, m_free(NULL)
+		, m_capacity(0)
+		, m_numLive(0)
+		, m_peakLive(0)
+		, m_totalAllocs(0)
+	{ }
+
+	~SlabPool()
+	{
+		DbgAssert(m_numLive == 0 && "LEAK - Items were not returned to the pool");
+		while (m_slabs != NULL)
+		{
+			Slab* pSlab = m_slabs;
+			m_slabs = pSlab->m_next;
+			delete [] reinterpret_cast<Storage*>(pSlab);
+		}
+	}
+
+	/// Ensure count more items can be allocated without allocating
+	/// more than one slab.  If the free items fall short, one slab is
+	/// allocated for the shortfall (or the usual next slab size, if larger).
+	void Reserve(size_t count)
+	{
+		size_t numFree = m_capacity - m_numLive;
+		if (count <= numFree)
+			return;
+		size_t nItems = count - numFree;
+		if (nItems < NextSlabSize())
+			nItems = NextSlabSize();
+		AllocateSlab(nItems);
+	}
+
+	/// Default-construct a new item
+	T* New()
+	{
+		if (m_free == NULL)
+			AllocateSlab(NextSlabSize());
+
+		FreeItem* pItem = m_free;
+		m_free = pItem->m_next;
+
+		m_numLive++;
+		m_totalAllocs++;
+		if (m_numLive > m_peakLive)
+			m_peakLive = m_numLive;
+
+		return new(pItem) T();
+	}
+
+	/// Destruct an item returned from New, and recycle its memory
+	void Delete(T* pItem)
+	{
+		if (pItem == NULL)
+			return;
+
+		pItem->~T();
+		FreeItem* pFree = reinterpret_cast<FreeItem*>(pItem);
+		pFree->m_next = m_free;
+		m_free = pFree;
+
+		DbgAssert(m_numLive > 0);
+		m_numLive--;
+	}
+
+	/// Return the current occupancy of the pool
+	SlabPoolStats GetStats() const
+	{
+		SlabPoolStats stats;
+		stats.numSlabs = 0;
+		for (const Slab* pSlab = m_slabs; pSlab != NULL; pSlab = pSlab->m_next)
+			stats.numSlabs++;
+		stats.capacity = m_capacity;
+		stats.numLive = m_numLive;
+		stats.numFree = m_capacity - m_numLive;
+		stats.peakLive = m_peakLive;
+		stats.totalAllocs = m_totalAllocs;
+		stats.totalFrees = m_totalAllocs - m_numLive;
+		return stats;
+	}
+};
@@ -0,0 +1,128 @@
+//
+// Copyright 2009 Autodesk, Inc.  All rights reserved.
+//
+// Use of this software is subject to the terms of the Autodesk license
+// agreement provided at the time of installation or download, or which
+// otherwise accompanies this software in either electronic or hard copy form.
+//
+
+#pragma once
+
+#include <assert1.h>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+// std::is_trivially_copyable needs Visual Studio 2013 (v120).  Older
+// compilers have an intrinsic that is equivalent for the types we store.
+#if defined(_MSC_VER) && _MSC_VER < 1800
+#define REFMGR_IS_TRIVIALLY_COPYABLE(T) __has_trivial_copy(T)
+#else
+#define REFMGR_IS_TRIVIALLY_COPYABLE(T) std::is_trivially_copyable<T>::value
+#endif
+
+//=========================================================
+/// A growable array that stores its first N items inside
+/// the object itself.
+///
+/// Only when more than N items are needed is a buffer allocated
+/// from the heap, so a small array costs no allocations at all.
+/// The interface follows the parts of MaxSDK::Array used by
+/// the ReferenceManager.
+///
+/// Items are moved with memcpy/memmove, so T must be trivially
+/// copyable.  Items beyond length() are not initialized.
+template<typename T, size_t N>
+class SmallArray
+{
+	static_assert(N > 0, "SmallArray must have at least one inline item");
+	static_assert(REFMGR_IS_TRIVIALLY_COPYABLE(T), "SmallArray items must be trivially copyable");
+
+private:
+	T* m_data;			// Either m_inline or a heap buffer
+	unsigned int m_length;	// 32 bits is plenty, and keeps every manager smaller
+	unsigned int m_capacity;
+	T m_inline[N];
+
+	// disable copy
+	SmallArray(const SmallArray&);
+	SmallArray& operator=(const SmallArray&);
+
+	bool IsInline() const { return m_data == m_inline; }
+
+public:
+
+	SmallArray()
+		: m_data(m_inline)
+		, m_length(0)
+		, m_capacity(N)
+	{ }
+
+	~SmallArray()
+	{
+		if (!IsInline())
+			delete [] m_data;
+	}
+
+	/// Return the number of items in use
+	size_t length() const { return m_length; }
+
+	/// Return true if the items have spilled to the heap
+	bool isUsingHeap() const { return !IsInline(); }
+
+	T& operator[](size_t i) { DbgAssert(i < m_length); return m_data[i]; }
+	const T& operator[](size_t i) const { DbgAssert(i < m_length); return m_data[i]; }
+
+	/// Direct access to the items, valid until the array next grows
+	T* asArrayPtr() { return m_data; }
+	const T* asArrayPtr() const { return m_data; }
+
+	/// Ensure there is room for capacity items without reallocating
+	void reserve(size_t capacity)
+	{
+		if (capacity <= m_capacity)
+			return;
+
+		// Grow geometrically, so repeated appends are amortized O(1)
+		size_t newCapacity = m_capacity * 2;
+		if (newCapacity < capacity)
+			newCapacity = capacity;
+
+		T* pNew = new T[newCapacity];
+		memcpy(pNew, m_data, m_length * sizeof(T));
+		if (!IsInline())
+			delete [] m_data;
+		m_data = pNew;
+		m_capacity = (unsigned int)newCapacity;
+	}
+
+	/// Set the number of items in use.  New items are set to fill.
+	void setLengthUsed(size_t length, const T& fill = T())
+	{
+		reserve(length);
+		for (size_t i = m_length; i < length; i++)
+			m_data[i] = fill;
+		m_length = (unsigned int)length;
+	}
+
+	/// Add an item to the end
+	void append(const T& value)
+	{
+		// value may live in our own buffer, copy it before growing
+		T copy = value;
+		reserve(m_length + 1);
+		m_data[m_length++] = copy;
+	}
+
+	/// Insert count copies of value before index
+	void insertAt(size_t index, const T& value, size_t count = 1)
+	{
+		DbgAssert(index <= m_length);
+		T copy = value;
+		reserve(m_length + count);
+		memmove(m_data + index + count, m_data + index, (m_length - index) * sizeof(T));
+		for (size_t i = 0; i < count; i++)
+			m_data[index + i] = copy;
+		m_length += (unsigned int)count;
+	}
+};
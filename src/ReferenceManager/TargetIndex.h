@@ -0,0 +1,226 @@
+//
+// Copyright 2009 Autodesk, Inc.  All rights reserved.
+//
+// Use of this software is subject to the terms of the Autodesk license
+// agreement provided at the time of installation or download, or which
+// otherwise accompanies this software in either electronic or hard copy form.
+//
+
+#pragma once
+
+#include <assert1.h>
+#include <cstddef>
+#include <cstring>
+
+//=========================================================
+/// Maps each key to every item that has been indexed under it.
+///
+/// The items of one key are chained through their own
+/// m_pNextSameTarget and m_pPrevSameTarget members, so the table
+/// holds a single entry per distinct key: the head of its chain.
+/// The table is open addressed (linear probing), and is only
+/// reallocated when it grows.  So indexing and unindexing an item
+/// never allocate, and an index that was never used holds no memory.
+///
+/// ITEM_T must have the members ITEM_T* m_pNextSameTarget and
+/// ITEM_T* m_pPrevSameTarget, initialized to NULL.  The index owns
+/// them while the item is indexed.  Keys may not be NULL.
+///
+/// This class is not thread-safe.
+template<typename KEY_T, typename ITEM_T>
+class TargetIndex
+{
+private:
+	struct Entry
+	{
+		const KEY_T* m_key;	// NULL if this entry is empty
+		ITEM_T* m_head;		// The most recently indexed item of m_key
+	};
+
+	Entry* m_entries;
+	unsigned int m_numEntries;	// The number of distinct keys
+	unsigned int m_shift;		// The capacity is 1 << (64 - m_shift)
+
+	// disable copy
+	TargetIndex(const TargetIndex&);
+	TargetIndex& operator=(const TargetIndex&);
+
+	size_t Capacity() const { return (m_entries != NULL) ? size_t(1) << (64 - m_shift) : 0; }
+
+	// Fibonacci hashing, so aligned pointers spread over the whole table
+	size_t Home(const KEY_T* key) const
+	{
+		return size_t((static_cast<unsigned long long>(reinterpret_cast<size_t>(key)) * 0x9E3779B97F4A7C15ULL) >> m_shift);
+	}
+
+	// Returns the entry holding key, or NULL
+	Entry* FindEntry(const KEY_T* key) const
+	{
+		if (m_entries == NULL || key == NULL)
+			return NULL;
+
+		size_t mask = Capacity() - 1;
+		for (size_t i = Home(key); ; i = (i + 1) & mask)
+		{
+			if (m_entries[i].m_key == key)
+				return &m_entries[i];
+			if (m_entries[i].m_key == NULL)
+				return NULL;
+		}
+	}
+
+	// Reallocate the table with room for capacity entries (a power of 2)
+	void Rehash(size_t capacity)
+	{
+		Entry* pOld = m_entries;
+		size_t oldCapacity = Capacity();
+
+		unsigned int shift = 64;
+		while ((size_t(1) << (64 - shift)) < capacity)
+			shift--;
+		m_shift = shift;
+		m_entries = new Entry[capacity];
+		memset(m_entries, 0, capacity * sizeof(Entry));
+
+		size_t mask = capacity - 1;
+		for (size_t i = 0; i < oldCapacity; i++)
+		{
+			if (pOld[i].m_key == NULL)
+				continue;
+			size_t j = Home(pOld[i].m_key);
+			while (m_entries[j].m_key != NULL)
+				j = (j + 1) & mask;
+			m_entries[j] = pOld[i];
+		}
+		delete [] pOld;
+	}
+
+	// Empty the entry at i, and move up any entries that probed past it
+	void EraseEntry(size_t i)
+	{
+		size_t mask = Capacity() - 1;
+		for (size_t j = (i + 1) & mask; m_entries[j].m_key != NULL; j = (j + 1) & mask)
+		{
+			// An entry may fill the hole if the hole is no further from its home than it is
+			size_t home = Home(m_entries[j].m_key);
+			if (((j - home) & mask) >= ((j - i) & mask))
+			{
+				m_entries[i] = m_entries[j];
+				i = j;
+			}
+		}
+		m_entries[i].m_key = NULL;
+		m_entries[i].m_head = NULL;
+		m_numEntries--;
+	}
+
+public:
+
+	TargetIndex()
+		: m_entries(NULL)
+		, m_numEntries(0)
+		, m_shift(64)
+	{ }
+
+	~TargetIndex()
+	{
+		delete [] m_entries;
+	}
+
+	/// Returns the number of distinct keys
+	size_t size() const { return m_numEntries; }
+
+	/// Make room for numKeys distinct keys, so they can be indexed without reallocating
+	void reserve(size_t numKeys)
+	{
+		// Keep the table at most half full
+		size_t capacity = 8;
+		while (capacity < numKeys * 2)
+			capacity *= 2;
+		if (capacity > Capacity())
+			Rehash(capacity);
+	}
+
+	/// Returns the first item indexed under key, or NULL if there are none.
+	/// Follow m_pNextSameTarget for the rest.
+	ITEM_T* Find(const KEY_T* key) const
+	{
+		Entry* pEntry = FindEntry(key);
+		return (pEntry != NULL) ? pEntry->m_head : NULL;
+	}
+
+	/// Index pItem under key.  pItem must not already be indexed.
+	void Insert(const KEY_T* key, ITEM_T* pItem)
+	{
+		DbgAssert(key != NULL && pItem != NULL);
+		DbgAssert(pItem->m_pNextSameTarget == NULL && pItem->m_pPrevSameTarget == NULL);
+
+		Entry* pEntry = FindEntry(key);
+		if (pEntry != NULL)
+		{
+			// Chain in front of the items already indexed
+			pItem->m_pNextSameTarget = pEntry->m_head;
+			pEntry->m_head->m_pPrevSameTarget = pItem;
+			pEntry->m_head = pItem;
+			return;
+		}
+
+		if ((m_numEntries + 1) * 2 > Capacity())
+			reserve(m_numEntries + 1);
+
+		size_t mask = Capacity() - 1;
+		size_t i = Home(key);
+		while (m_entries[i].m_key != NULL)
+			i = (i + 1) & mask;
+		m_entries[i].m_key = key;
+		m_entries[i].m_head = pItem;
+		m_numEntries++;
+	}
+
+	/// Remove pItem from the items indexed under key.
+	/// Does nothing if pItem is not indexed under key.
+	void Remove(const KEY_T* key, ITEM_T* pItem)
+	{
+		if (pItem->m_pPrevSameTarget != NULL)
+		{
+			pItem->m_pPrevSameTarget->m_pNextSameTarget = pItem->m_pNextSameTarget;
+			if (pItem->m_pNextSameTarget != NULL)
+				pItem->m_pNextSameTarget->m_pPrevSameTarget = pItem->m_pPrevSameTarget;
+		}
+		else
+		{
+			// The head of the chain, if indexed at all
+			Entry* pEntry = FindEntry(key);
+			if (pEntry == NULL || pEntry->m_head != pItem)
+				return;
+
+			if (pItem->m_pNextSameTarget != NULL)
+			{
+				pEntry->m_head = pItem->m_pNextSameTarget;
+				pEntry->m_head->m_pPrevSameTarget = NULL;
+			}
+			else
+				EraseEntry(size_t(pEntry - m_entries));
+		}
+		pItem->m_pNextSameTarget = NULL;
+		pItem->m_pPrevSameTarget = NULL;
+	}
+
+	/// Remove every item indexed under key
+	void RemoveAll(const KEY_T* key)
+	{
+		Entry* pEntry = FindEntry(key);
+		if (pEntry == NULL)
+			return;
+
+		ITEM_T* pItem = pEntry->m_head;
+		while (pItem != NULL)
+		{
+			ITEM_T* pNext = pItem->m_pNextSameTarget;
+			pItem->m_pNextSameTarget = NULL;
+			pItem->m_pPrevSameTarget = NULL;
+			pItem = pNext;
+		}
+		EraseEntry(size_t(pEntry - m_entries));
+	}
+};